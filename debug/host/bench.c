@@ -0,0 +1,110 @@
+// Measures the hot path of the driver (ns/packet) over millions of synthetic reports.
+// Usage: ./bench [packets] [engine: float|fixed|fallback]
+#include "kshim.h"
+#include "accel.h"
+#include "util.h"
+
+#include <stdlib.h>
+
+//SteelSeries Rival 600: 8 buttons, 16-bit X/Y, 8-bit wheel (see debug/devices)
+static unsigned char rdesc[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0xA1, 0x02, 0x05, 0x09, 0x19, 0x01,
+    0x29, 0x08, 0x15, 0x00, 0x25, 0x01, 0x95, 0x08, 0x75, 0x01, 0x81, 0x02, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F, 0x75, 0x10, 0x95, 0x02, 0x81, 0x06, 0x09, 0x38,
+    0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xA1, 0x02, 0x05, 0x0C, 0x0A,
+    0x38, 0x02, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xA1, 0x02, 0x06,
+    0xC1, 0xFF, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x09, 0xF0, 0x95, 0x02, 0x81, 0x02, 0xC0,
+    0xC0, 0xC0
+};
+
+//Synthetic reports are generated once up front, so the benchmark does not measure the random number generator
+#define NUM_REPORTS 4096
+#define REPORT_LEN 8
+
+static unsigned char reports[NUM_REPORTS][REPORT_LEN];
+
+static u64 now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+//Hand-moved mouse: Mostly small deltas, every now and then a flick
+static void generate_reports(void)
+{
+    int i, x, y;
+
+    srand(1);
+    for(i = 0; i < NUM_REPORTS; i++){
+        x = rand() % 16 == 0 ? rand() % 2001 - 1000 : rand() % 41 - 20;
+        y = rand() % 16 == 0 ? rand() % 2001 - 1000 : rand() % 41 - 20;
+        reports[i][0] = rand() % 4 == 0;
+        reports[i][1] = x & 0xff;
+        reports[i][2] = (x >> 8) & 0xff;
+        reports[i][3] = y & 0xff;
+        reports[i][4] = (y >> 8) & 0xff;
+        reports[i][5] = rand() % 32 == 0 ? (rand() % 2 ? 1 : -1) : 0;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long packets = argc > 1 ? atol(argv[1]) : 10000000;
+    const char *engine = argc > 2 ? argv[2] : "float";
+    static struct report_positions pos;
+    static struct accel_state state;
+    int btn, x, y, wheel, fields, ret;
+    long i, failed = 0;
+    s64 sum = 0;
+    u64 start, extract_ns, accel_ns;
+
+    if(parse_report_desc(rdesc, sizeof(rdesc), &pos) < 0){
+        fprintf(stderr, "Cannot parse the report descriptor\n");
+        return 1;
+    }
+    generate_reports();
+
+    //The engine must be chosen before the first lookup table is built. Parameters only update, once set up as on module load.
+    accel_setup();
+    shim_fpu = strcmp(engine, "fallback") != 0;
+    shim_param_set("FixedPoint", strcmp(engine, "fixed") ? "0" : "1");
+    shim_param_set("update", "1");
+    accel_init(&state, 1000);
+
+    //Stage 1: Extraction only
+    start = now_ns();
+    for(i = 0; i < packets; i++){
+        fields = extract_mouse_events(reports[i % NUM_REPORTS], REPORT_LEN, &pos, &btn, &x, &y, &wheel);
+        sum += fields + btn + x + y + wheel;
+    }
+    extract_ns = now_ns() - start;
+
+    //Stage 2: Extraction and acceleration. The clock of the driver advances by one polling interval (1 ms) per packet.
+    shim_now = 0;
+    start = now_ns();
+    for(i = 0; i < packets; i++){
+        shim_now += NSEC_PER_MSEC;
+        extract_mouse_events(reports[i % NUM_REPORTS], REPORT_LEN, &pos, &btn, &x, &y, &wheel);
+        ret = accelerate(&state, &x, &y, &wheel);
+        if(ret < 0)
+            failed++;
+        sum += x + y + wheel;
+    }
+    accel_ns = now_ns() - start;
+    shim_now = -1;
+
+    accel_release(&state);
+    accel_cleanup();
+
+    printf("engine:     %s\n", engine);
+    printf("packets:    %ld\n", packets);
+    printf("extract:    %.2f ns/packet\n", (double) extract_ns / packets);
+    printf("accelerate: %.2f ns/packet (without extraction)\n", (double) (accel_ns - extract_ns) / packets);
+    printf("total:      %.2f ns/packet\n", (double) accel_ns / packets);
+    printf("failed:     %ld\n", failed);
+    printf("checksum:   %lld\n", sum);
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Decodes the binary records of a capture (/sys/kernel/debug/leetmouse/<device>/capture, see driver/capture.h).
+// By default, every record is printed in the output format of replay, so what the driver did can be diffed against a replay of the same packets.
+//
+// Usage: ./capture_dump [-r] <capture|->
+//   -r   Print the raw reports instead, as a capture for replay (timestamp and hex bytes per line)
+#include "kshim.h"
+#include "capture.h"
+
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+    struct capture_record r;
+    int raw = 0, opt, i, n;
+    long records = 0, dropped = 0, truncated = 0;
+    u64 first_ts = 0;
+    u32 seq = 0;
+    FILE *f;
+
+    while((opt = getopt(argc, argv, "r")) != -1){
+        switch(opt){
+        case 'r': raw = 1; break;
+        default:
+            fprintf(stderr, "Usage: %s [-r] <capture|->\n", argv[0]);
+            return 1;
+        }
+    }
+    if(argc - optind != 1){
+        fprintf(stderr, "Usage: %s [-r] <capture|->\n", argv[0]);
+        return 1;
+    }
+
+    f = strcmp(argv[optind], "-") ? fopen(argv[optind], "rb") : stdin;
+    if(!f){
+        perror(argv[optind]);
+        return 1;
+    }
+    if(!raw)
+        printf("# t_ns fields btn x y wheel out_x out_y out_wheel status\n");
+
+    while(fread(&r, sizeof(r), 1, f) == 1){
+        if(!records)
+            first_ts = r.ts;
+        else
+            dropped += (u32) (r.seq - seq - 1);   //Gaps in the packet numbers are packets, which did not fit into the ring
+        seq = r.seq;
+        records++;
+        if(r.len > CAPTURE_DATA)
+            truncated++;
+
+        if(!raw){
+            printf("%llu %d %d %d %d %d %d %d %d %d\n", r.ts - first_ts, r.fields, r.btn, r.x, r.y, r.wheel, r.out_x, r.out_y, r.out_wheel, r.status);
+            continue;
+        }
+        n = min_t(int, r.len, CAPTURE_DATA);
+        printf("%llu.%09llu", r.ts / 1000000000ull, r.ts % 1000000000ull);
+        for(i = 0; i < n; i++)
+            printf("%s0x%02x", i ? ", " : " ", r.data[i]);
+        printf("\n");
+    }
+    if(f != stdin)
+        fclose(f);
+
+    fprintf(stderr, "records:    %ld (%ld dropped, %ld truncated)\n", records, dropped, truncated);
+    return 0;
+}
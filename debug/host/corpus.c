@@ -0,0 +1,24 @@
+// The report descriptors collected in debug/hid_parser/hid_parser.h, as a table for the host tools.
+// A translation unit of its own, since hid_parser.h also brings its own copy of the descriptor enums and structs of util.h.
+#include "../hid_parser/hid_parser.h"
+#include "corpus.h"
+
+static const unsigned char steelseries_rival_600[] = { STEELSERIES_RIVAL_600 };
+static const unsigned char csl_optical_mouse[] = { CSL_OPTICAL_MOUSE };
+static const unsigned char logitech_g5[] = { LOGITECH_G5 };
+static const unsigned char coolermaster_mm710[] = { COOLERMASTER_MM710 };
+static const unsigned char swiftpoint_tracer[] = { SWIFTPOINT_TRACER };
+static const unsigned char trust_gxt[] = { TRUST_GXT };
+
+#define CORPUS_ENTRY(name) { #name, name, sizeof(name) }
+
+const struct corpus_entry corpus[] = {
+    CORPUS_ENTRY(steelseries_rival_600),
+    CORPUS_ENTRY(csl_optical_mouse),
+    CORPUS_ENTRY(logitech_g5),
+    CORPUS_ENTRY(coolermaster_mm710),
+    CORPUS_ENTRY(swiftpoint_tracer),
+    CORPUS_ENTRY(trust_gxt),
+};
+
+const unsigned int corpus_len = sizeof(corpus) / sizeof(corpus[0]);
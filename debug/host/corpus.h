@@ -0,0 +1,14 @@
+#ifndef _CORPUS_H
+#define _CORPUS_H
+
+// Report descriptors of debug/hid_parser/hid_parser.h (see corpus.c)
+struct corpus_entry {
+    const char *name;
+    const unsigned char *desc;
+    unsigned int len;
+};
+
+extern const struct corpus_entry corpus[];
+extern const unsigned int corpus_len;
+
+#endif  //_CORPUS_H
@@ -0,0 +1,167 @@
+// Validates the sensitivity curves of all acceleration modes against a double precision reference.
+// The driver's curves are evaluated with the inline float arithmetic of float.h and then only ever looked up from a table. Both add errors, which this tool measures separately:
+//   curve:  The curve as evaluated while building the table (float.h arithmetic). Not shown for a gain, whose table holds the integral of the curve.
+//   float:  Lookup (with interpolation) in the float table, as done by the floating point engine
+//   fixed:  Lookup in the fixed-point table, as done by the fixed-point engine and the fallback
+// Errors are relative to the reference sensitivity, sampled over the table and twice beyond, but not beyond LUT_MAX_RANGE (faster than any mouse). For a gain, the reference is the integral of the curve divided by the rate.
+//
+// Usage: ./curves [samples]
+#include "kshim.h"
+#include "accel.c"      //White-box: The curves and the table are internal to the driver
+
+// No <math.h> here: Its isfinite() clashes with the one of float.h
+double exp(double);
+double log(double);
+double pow(double, double);
+double tanh(double);
+double fabs(double);
+long atol(const char *);
+
+// Straight line through the points of a custom curve, constant beyond them
+static double custom_reference(const struct accel_params *p, double rate)
+{
+    const struct accel_point *pt = p->Curve;
+    unsigned int i, n = p->CurvePoints;
+
+    if(rate <= pt[0].speed)
+        return pt[0].sens;
+    for(i = 1; i < n; i++)
+        if(rate < pt[i].speed)
+            return pt[i - 1].sens + (rate - pt[i - 1].speed) * ((double) pt[i].sens - pt[i - 1].sens) / ((double) pt[i].speed - pt[i - 1].speed);
+    return pt[n - 1].sens;
+}
+
+// Reference curves, written down independently from the driver's (double precision, libm)
+static double reference(const struct accel_params *p, double rate)
+{
+    double s = p->Sensitivity, cap = p->SensitivityCap, a = p->Acceleration, sens;
+
+    if(rate < 0)
+        rate = 0;
+    if(p->AccelMode == MODE_CUSTOM)
+        return custom_reference(p, rate);
+    switch(p->AccelMode){
+    case MODE_CLASSIC:      sens = s + pow(a * rate, p->Exponent - 1); break;
+    case MODE_POWER:        sens = s * pow(1 + a * rate, p->Exponent); break;
+    case MODE_NATURAL:      sens = cap - (cap - s) * exp(-a * rate); break;
+    case MODE_JUMP:         sens = a <= 0 ? (rate < p->Midpoint ? s : cap) : s + (cap - s) / (1 + exp(-a * (rate - p->Midpoint))); break;
+    case MODE_SYNCHRONOUS:  sens = s * pow(cap / s, rate > 0 ? tanh(a * log(rate / p->Midpoint)) : (a > 0 ? -1 : 0)); break;
+    default:                sens = s + a * rate; break;
+    }
+    if(p->AccelMode <= MODE_POWER && cap > 0 && sens > cap)
+        sens = cap;
+    return sens / s;
+}
+
+// Gain: The output speed is the integral of the reference curve, so the sensitivity is that integral divided by the rate.
+// Rates must ascend from call to call: The integral is carried on from the previous rate (Simpson's rule).
+static double gain_reference(const struct accel_params *p, double rate, double *integral, double *prev)
+{
+    if(rate > *prev){
+        *integral += (rate - *prev) / 6 * (reference(p, *prev) + 4 * reference(p, (*prev + rate) / 2) + reference(p, rate));
+        *prev = rate;
+    }
+    return rate > 0 ? *integral / rate : reference(p, 0);
+}
+
+struct error {
+    double max;
+    double at;
+};
+
+static void error_add(struct error *e, double value, double ref, double rate)
+{
+    double err = fabs(value - ref) / fabs(ref);
+
+    if(err > e->max){
+        e->max = err;
+        e->at = rate;
+    }
+}
+
+static const char *mode_names[] = { "linear", "classic", "power", "natural", "jump", "synchronous", "custom" };
+
+static void validate(const char *desc, struct accel_params *p, long samples)
+{
+    static struct accel_lut lut;
+    struct error e_curve = {0}, e_float = {0}, e_fixed = {0};
+    float range, span, rate;
+    double ref, integral = 0, prev = 0;
+    int flat;
+    long i;
+
+    //The update refuses these. Their table would be extrapolated with a slope, which the curve does not keep.
+    if(!params_valid(p)){
+        printf("%-12s %-40s %9s\n", mode_names[p->AccelMode], desc, "rejected");
+        return;
+    }
+    lut_build(&lut, p);
+    range = lut_range(p, &flat);
+    span = 3.0f * range < LUT_MAX_RANGE ? 3.0f * range : LUT_MAX_RANGE;
+
+    for(i = 0; i <= samples; i++){
+        rate = span * i / samples;
+        ref = p->Gain ? gain_reference(p, rate, &integral, &prev) : reference(p, rate);
+        //A hard step has no defined value right at it. Skip the one table interval, over which the table interpolates it.
+        if(p->AccelMode == MODE_JUMP && p->Acceleration <= 0 && rate > p->Midpoint - range / (ACCEL_LUT_SIZE - 1) && rate < p->Midpoint + range / (ACCEL_LUT_SIZE - 1))
+            continue;
+        //For a gain, the table holds the integral, not the curve itself
+        if(!p->Gain)
+            error_add(&e_curve, sens_curve(p, rate), ref, rate);
+        error_add(&e_float, lut_lookup(&lut, rate), ref, rate);
+        error_add(&e_fixed, (double) lut_lookup_fixed(&lut, (fixedpt) (rate * FP_ONE)) / FP_ONE, ref, rate);
+    }
+
+    printf("%-12s %-40s %9.3f %-4s ", mode_names[p->AccelMode], desc, range, flat ? "flat" : "tail");
+    if(p->Gain)
+        printf("%9s", "-");
+    else
+        printf("%9.2e", e_curve.max);
+    printf(" %9.2e (at %8.3f) %9.2e (at %8.3f)\n", e_float.max, e_float.at, e_fixed.max, e_fixed.at);
+}
+
+#define P_GAIN(gain, mode, sens, accel, cap, exponent, midpoint) \
+    (struct accel_params) { .AccelMode = mode, .Gain = gain, .Sensitivity = sens, .Acceleration = accel, .SensitivityCap = cap, .Exponent = exponent, .Midpoint = midpoint }
+#define P(...) P_GAIN(0, __VA_ARGS__)
+#define G(...) P_GAIN(1, __VA_ARGS__)
+
+int main(int argc, char **argv)
+{
+    long samples = argc > 1 ? atol(argv[1]) : 100000;
+    struct {
+        const char *desc;
+        struct accel_params p;
+    } cases[] = {
+        { "sens 0.85, accel 0.26, cap 4",               P(MODE_LINEAR,      0.85f, 0.26f, 4.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 0.05, no cap",                 P(MODE_LINEAR,      1.0f,  0.05f, 0.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 0.1, exp 2 (linear)",          P(MODE_CLASSIC,     1.0f,  0.1f,  0.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 0.1, exp 2.5, cap 3",          P(MODE_CLASSIC,     1.0f,  0.1f,  3.0f, 2.5f, 5.0f) },
+        { "sens 1, accel 0.05, exp 1.5, no cap",        P(MODE_CLASSIC,     1.0f,  0.05f, 0.0f, 1.5f, 5.0f) },
+        { "sens 1, accel 0.05, exp 0.5, cap 2",         P(MODE_POWER,       1.0f,  0.05f, 2.0f, 0.5f, 5.0f) },
+        { "sens 0.5, accel 0.2, exp 1.2, no cap",       P(MODE_POWER,       0.5f,  0.2f,  0.0f, 1.2f, 5.0f) },
+        { "sens 1, accel 0.1, cap 2",                   P(MODE_NATURAL,     1.0f,  0.1f,  2.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 0.5, cap 4",                   P(MODE_NATURAL,     1.0f,  0.5f,  4.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 0.00001, cap 2 (slow)",        P(MODE_NATURAL,     1.0f,  0.00001f, 2.0f, 2.0f, 5.0f) },
+        { "sens 1, cap 2, midpoint 5 (hard step)",      P(MODE_JUMP,        1.0f,  0.0f,  2.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 2, cap 2, midpoint 5",         P(MODE_JUMP,        1.0f,  2.0f,  2.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 1, cap 2, midpoint 5",         P(MODE_SYNCHRONOUS, 1.0f,  1.0f,  2.0f, 2.0f, 5.0f) },
+        { "sens 1, accel 3, cap 1.5, midpoint 10",      P(MODE_SYNCHRONOUS, 1.0f,  3.0f,  1.5f, 2.0f, 10.0f) },
+        { "gain: sens 0.85, accel 0.26, cap 4",         G(MODE_LINEAR,      0.85f, 0.26f, 4.0f, 2.0f, 5.0f) },
+        { "gain: sens 1, accel 0.05, no cap",           G(MODE_LINEAR,      1.0f,  0.05f, 0.0f, 2.0f, 5.0f) },
+        { "gain: sens 1, accel 0.1, exp 2.5, cap 3",    G(MODE_CLASSIC,     1.0f,  0.1f,  3.0f, 2.5f, 5.0f) },
+        { "gain: sens 1, accel 0.1, cap 2",             G(MODE_NATURAL,     1.0f,  0.1f,  2.0f, 2.0f, 5.0f) },
+        { "gain: sens 1, cap 2, midpoint 5 (step)",     G(MODE_JUMP,        1.0f,  0.0f,  2.0f, 2.0f, 5.0f) },
+        { "gain: sens 1, accel 1, cap 2, midpoint 5",   G(MODE_SYNCHRONOUS, 1.0f,  1.0f,  2.0f, 2.0f, 5.0f) },
+    };
+    static const struct accel_point custom[] = { {0, 1}, {2, 1}, {10, 1.8f}, {30, 2.5f}, {80, 2.6f} };
+    static struct accel_params p_custom = { .AccelMode = MODE_CUSTOM, .Sensitivity = 1.0f, .CurvePoints = 5 };
+    unsigned int i;
+
+    printf("%-12s %-40s %9s %-4s %9s %9s %-12s %9s\n", "mode", "parameters", "range", "", "curve", "float", "", "fixed");
+    for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        validate(cases[i].desc, &cases[i].p, samples);
+    memcpy(p_custom.Curve, custom, sizeof(custom));
+    validate("5 points up to 80", &p_custom, samples);
+
+    return 0;
+}
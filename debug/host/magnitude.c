@@ -0,0 +1,173 @@
+// Error profile and benchmark of the magnitude kernels, which turn a motion (dx, dy) into a speed:
+//   B_sqrt:      float.h, Blinn's approximation of sqrt(dx² + dy²) with one Newton step (the floating point engine up to now)
+//   Leet_hypot:  float.h, tuned guess and scaled Newton step (the floating point engine)
+//   fp_hypot:    fixedpoint.h, integer square root of the Q32.32 squared sum (the fixed-point engine)
+// The profile covers every delta of a 16-bit mouse (-32768..32767 on both axes). Since all kernels only depend on the squares, one octant (0 <= dy <= dx) covers all of them.
+// Errors are relative to a double precision reference, grouped by the octave of the magnitude.
+//
+// Usage: ./magnitude [step] [calls]
+//   step   Only profile every step-th dx and dy (1 by default: the full range)
+//   calls  Number of calls per kernel for the benchmark
+#include "kshim.h"
+#include "float.h"
+#include "fixedpoint.h"
+
+// No <math.h> here: Its isfinite() clashes with the one of float.h
+double sqrt(double);
+float sqrtf(float);
+long atol(const char *);
+int rand(void);
+void srand(unsigned int);
+
+#define KERNELS 3
+#define OCTAVES 17      //Magnitudes up to 32768 * sqrt(2)
+static const char *names[KERNELS] = { "B_sqrt", "Leet_hypot", "fp_hypot" };
+
+static INLINE float mag_blinn(float x, float y)
+{
+    float s = x * x + y * y;
+
+    B_sqrt(&s);
+    return s;
+}
+
+static INLINE float mag_leet(float x, float y)
+{
+    return Leet_hypot(&x, &y);
+}
+
+static INLINE fixedpt mag_fixed(int x, int y)
+{
+    return fp_hypot(FP_FROM_INT(x), FP_FROM_INT(y));
+}
+
+struct error {
+    double max;
+    double sum;
+    long n;
+    int at_x, at_y;
+};
+
+static void error_add(struct error *e, double value, double ref, int x, int y)
+{
+    double err = value / ref - 1;
+
+    if(err < 0)
+        err = -err;
+    e->sum += err;
+    e->n++;
+    if(err > e->max){
+        e->max = err;
+        e->at_x = x;
+        e->at_y = y;
+    }
+}
+
+static void profile(long step)
+{
+    static struct error octave[OCTAVES][KERNELS], total[KERNELS];
+    double ref;
+    long x, y;
+    int k, o;
+
+    for(x = 1; x <= 32768; x += step){
+        for(y = 0; y <= x; y += step){
+            ref = sqrt((double) (x * x + y * y));
+            o = 63 - __builtin_clzll((u64) ref);
+            error_add(&octave[o][0], mag_blinn(x, y), ref, x, y);
+            error_add(&octave[o][1], mag_leet(x, y), ref, x, y);
+            error_add(&octave[o][2], (double) mag_fixed(x, y) / FP_ONE, ref, x, y);
+        }
+    }
+
+    printf("Relative error by magnitude (max / mean)\n%-16s", "magnitude");
+    for(k = 0; k < KERNELS; k++)
+        printf(" %23s", names[k]);
+    printf("\n");
+    for(o = 0; o < OCTAVES; o++){
+        if(!octave[o][0].n)
+            continue;
+        printf("%6d - %-7d", 1 << o, (2 << o) - 1);
+        for(k = 0; k < KERNELS; k++){
+            printf("   %9.2e / %9.2e", octave[o][k].max, octave[o][k].sum / octave[o][k].n);
+            if(octave[o][k].max > total[k].max){
+                total[k].max = octave[o][k].max;
+                total[k].at_x = octave[o][k].at_x;
+                total[k].at_y = octave[o][k].at_y;
+            }
+            total[k].sum += octave[o][k].sum;
+            total[k].n += octave[o][k].n;
+        }
+        printf("\n");
+    }
+    printf("%-16s", "all");
+    for(k = 0; k < KERNELS; k++)
+        printf("   %9.2e / %9.2e", total[k].max, total[k].sum / total[k].n);
+    printf("\n%-16s", "worst at (x, y)");
+    for(k = 0; k < KERNELS; k++)
+        printf("        (%6d, %6d)", total[k].at_x, total[k].at_y);
+    printf("\n\n");
+}
+
+static u64 now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Deltas of a hand-moved mouse, as in bench.c: Mostly small ones, every now and then a flick
+#define NUM_DELTAS 4096
+static int dx[NUM_DELTAS], dy[NUM_DELTAS];
+static float fdx[NUM_DELTAS], fdy[NUM_DELTAS];
+
+static void bench(long calls)
+{
+    volatile float fsink;
+    volatile fixedpt sink;
+    float fsum;
+    fixedpt sum;
+    u64 start;
+    long i;
+    int k;
+
+    srand(1);
+    for(i = 0; i < NUM_DELTAS; i++){
+        dx[i] = rand() % 16 == 0 ? rand() % 2001 - 1000 : rand() % 41 - 20;
+        dy[i] = rand() % 16 == 0 ? rand() % 2001 - 1000 : rand() % 41 - 20;
+        fdx[i] = dx[i];
+        fdy[i] = dy[i];
+    }
+
+    printf("Benchmark (%ld calls)\n", calls);
+    for(k = 0; k <= KERNELS; k++){
+        fsum = 0;
+        sum = 0;
+        start = now_ns();
+        switch(k){
+        case 0: for(i = 0; i < calls; i++) fsum += mag_blinn(fdx[i % NUM_DELTAS], fdy[i % NUM_DELTAS]); break;
+        case 1: for(i = 0; i < calls; i++) fsum += mag_leet(fdx[i % NUM_DELTAS], fdy[i % NUM_DELTAS]); break;
+        case 2: for(i = 0; i < calls; i++) sum += mag_fixed(dx[i % NUM_DELTAS], dy[i % NUM_DELTAS]); break;
+        //Only for comparison: The kernel cannot call into libm
+        case 3: for(i = 0; i < calls; i++) fsum += sqrtf(fdx[i % NUM_DELTAS] * fdx[i % NUM_DELTAS] + fdy[i % NUM_DELTAS] * fdy[i % NUM_DELTAS]); break;
+        }
+        printf("%-12s %6.2f ns/call\n", k < KERNELS ? names[k] : "sqrtf (libm)", (double) (now_ns() - start) / calls);
+        fsink = fsum;
+        sink = sum;
+    }
+    (void) fsink;
+    (void) sink;
+}
+
+int main(int argc, char **argv)
+{
+    long step = argc > 1 ? atol(argv[1]) : 1;
+    long calls = argc > 2 ? atol(argv[2]) : 100000000;
+
+    if(step < 1)
+        step = 1;
+    profile(step);
+    bench(calls);
+    return 0;
+}
@@ -0,0 +1,166 @@
+// Checks the compiled extraction plan of util.c against the extraction it replaced (extract_at(), copied below as it was), over every descriptor of debug/hid_parser.
+// Random packets of the full report length are extracted both ways. Writing the extracted values back with insert_mouse_events() must leave the packet untouched.
+// Packets cut short are not compared: The old extraction returned 0 for a field beyond their end, the plan drops the whole packet.
+//
+// Usage: ./plan_check [packets per descriptor]
+#include "kshim.h"
+#include "util.h"
+#include "corpus.h"
+
+#include <stdlib.h>
+
+// ########## The extraction before the plan (driver/util.c up to the compiled report_field)
+
+//Shifts an array *data of length data_len (in bytes) by amounts of num in bits to the right/left, depending on right = 1/0 (maximum bits to shift: 8)
+static void array_shift_le(unsigned char *data, int data_len, bool right, int num){
+    int i;
+    if(num == 0) return;
+
+    //Right shift
+    if(right){
+        for(i = 0; i < data_len; i++){
+            data[i] >>= num;
+            if(i + 1 < data_len){
+                data[i] |= data[i+1] << (8 - num);
+            }
+        }
+    //Left shift
+    } else {
+        for(i = data_len - 1; i >= 0; i--){
+            data[i] <<= num;
+            if(i){
+                data[i] |= data[i-1] >> (8 - num);
+            }
+        }
+    }
+}
+
+//Extracts a number from a raw USB stream, according to its bit-position and bit-size as stated in the report_entry
+static int extract_at(unsigned char *data, int data_len, const struct report_entry *entry)
+{
+    int size = entry->size/8;           //Size of our data in bytes
+    int i = entry->offset/8;            //Starting index of data[] to access in byte-aligned size
+    char shift = entry->offset % 8;     //Remaining bits to shift left, until we reach our target data
+    union {
+        __u8 raw[4];
+        __u32 init;
+        __s8 s8;
+        __s16 s16;
+        __u8 u8;
+        __u16 u16;
+    } buffer;
+
+    if(entry->size % 8) size += 1;
+    if(shift) size += 1;
+    if(size > sizeof(buffer.init)) return 0;
+
+    buffer.init = 0;
+    if(i + size > data_len) return 0;
+    memcpy(buffer.raw, data + i, size);
+
+    if(shift)
+        array_shift_le(buffer.raw,size,true,shift);
+
+    if(entry->size <= 8){
+        buffer.raw[0] &= 0xFF >> (8 - entry->size);
+        if(entry->sgn)
+            buffer.raw[0] = buffer.raw[0] >> (8 - entry->size - 1) == 0 ? buffer.raw[0] : (0xFF ^ (0xFF >> (8 - entry->size))) | buffer.raw[0];
+
+        return (int) (entry->sgn ? buffer.s8 : buffer.u8);
+    }
+    if(entry->size <= 16){
+        buffer.raw[1] &= 0xFF >> (16 - entry->size);
+        if(entry->sgn)
+            buffer.raw[1] = buffer.raw[1] >> (16 - entry->size - 1) == 0 ? buffer.raw[1] : (0xFF ^ (0xFF >> (16 - entry->size))) | buffer.raw[1];
+
+        buffer.u16 = le16_to_cpu(buffer.u16);
+        return (int) (entry->sgn ? buffer.s16 : buffer.u16);
+    }
+
+    return 0;
+}
+
+// ########## Check
+
+//xorshift32: The same packets on every run and every libc
+static u32 g_rand = 2463534242u;
+
+static u32 next_rand(void)
+{
+    g_rand ^= g_rand << 13;
+    g_rand ^= g_rand >> 17;
+    g_rand ^= g_rand << 5;
+    return g_rand;
+}
+
+//Compares a field of the packet with the old extraction. Only the first mismatch per descriptor is printed.
+#define CHECK_FIELD(field, bit, value)                                                  \
+    if((l->fields & bit) && extract_at(packet, len, &l->field) != value){               \
+        if(!mismatches && !bad)                                                         \
+            printf("  %s of report %u: %d, before %d\n", #field, l->id, value, extract_at(packet, len, &l->field)); \
+        bad = 1;                                                                        \
+    }
+
+// Returns the number of packets, which did not pass
+static long check(const struct corpus_entry *c, long packets)
+{
+    static unsigned char desc[4096], packet[256], copy[256];  //4096: HID_MAX_DESCRIPTOR_SIZE
+    struct report_positions pos;
+    const struct report_layout *l;
+    int btn, x, y, wheel, fields, out[3], bad;
+    long i, mismatches = 0;
+    unsigned int n, len;
+
+    memcpy(desc, c->desc, c->len);
+    if(parse_report_desc(desc, c->len, &pos) < 0 || !pos.num_layouts){
+        printf("%-24s no mouse data found\n", c->name);
+        return 1;
+    }
+    len = pos.report_len;
+
+    for(i = 0; i < packets; i++){
+        l = pos.layouts + next_rand() % pos.num_layouts;
+        for(n = 0; n < len; n++)
+            packet[n] = next_rand();
+        if(pos.report_id_tagged)
+            packet[0] = l->id;
+
+        bad = 0;
+        fields = extract_mouse_events(packet, len, &pos, &btn, &x, &y, &wheel);
+        if(fields != l->fields){
+            if(!mismatches)
+                printf("  report %u: fields 0x%x, expected 0x%x\n", l->id, fields, l->fields);
+            mismatches++;
+            continue;
+        }
+        CHECK_FIELD(button, REPORT_BUTTON, btn);
+        CHECK_FIELD(x, REPORT_X, x);
+        CHECK_FIELD(y, REPORT_Y, y);
+        CHECK_FIELD(wheel, REPORT_WHEEL, wheel);
+
+        //The extracted values are within range by definition. Writing them back changes nothing.
+        memcpy(copy, packet, len);
+        out[0] = x; out[1] = y; out[2] = wheel;
+        insert_mouse_events(copy, &pos, fields, &out[0], &out[1], &out[2]);
+        if(memcmp(copy, packet, len) || ((fields & REPORT_X) && out[0] != x) || ((fields & REPORT_Y) && out[1] != y) || ((fields & REPORT_WHEEL) && out[2] != wheel)){
+            if(!mismatches && !bad)
+                printf("  report %u: writing the values back changed the packet\n", l->id);
+            bad = 1;
+        }
+        mismatches += bad;
+    }
+
+    printf("%-24s %u report(s), %3u bytes: %ld packets, %ld mismatches\n", c->name, pos.num_layouts, len, packets, mismatches);
+    return mismatches;
+}
+
+int main(int argc, char **argv)
+{
+    long packets = argc > 1 ? atol(argv[1]) : 200000, failed = 0;
+    unsigned int i;
+
+    for(i = 0; i < corpus_len; i++)
+        failed += check(corpus + i, packets);
+
+    return failed != 0;
+}
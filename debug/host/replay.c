@@ -0,0 +1,305 @@
+// Replays a packet capture through the real parse_report_desc(), extract_mouse_events() and accelerate().
+// Prints the input and output deltas of every packet to stdout (diffable for regression tests) and a timing summary per stage to stderr.
+// Packets are streamed: Captures of any size are processed with constant memory.
+//
+// Usage: ./replay [options] <descriptor> <capture|->
+//   -e <engine>       float (default), fixed or fallback (fixed-point, as used when the FPU is unusable)
+//   -i <n>            Use the n-th descriptor of a usbhid-dump file (default: the first one with mouse data)
+//   -u <us>           Polling interval, for captures without timestamps (default: 1000)
+//   -p <name=value>   Set a module parameter (e.g. -p Acceleration=0.3). May be given multiple times.
+//   -q                Do not print the packets, only the summary
+//   -t                Measure the time spent in every stage
+#include "kshim.h"
+#include "accel.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define MAX_PACKET 64
+#define MAX_DESCRIPTORS 16
+#define MAX_DESCRIPTOR_SIZE 4096
+
+struct packet {
+    unsigned char data[MAX_PACKET];
+    int len;
+    s64 ts;             // Capture timestamp in ns. Negative, if the capture has none.
+};
+
+struct stage_time {
+    u64 sum;
+    u64 max;
+};
+
+static struct report_positions pos;
+static struct accel_state state;
+static int quiet = 0, timing = 0;
+static s64 interval_ns = NSEC_PER_MSEC;
+static s64 first_ts = -1;
+static long packets = 0, rejected = 0, failed = 0;
+static struct stage_time t_extract, t_accel;
+
+static u64 now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void stage_add(struct stage_time *t, u64 ns)
+{
+    t->sum += ns;
+    if(ns > t->max)
+        t->max = ns;
+}
+
+// Parses a timestamp in seconds (e.g. "1618165844.728901") into ns without losing precision to a double
+static s64 parse_ts(const char *s)
+{
+    s64 sec = 0, frac = 0, scale = 1000000000ll;
+
+    while(isdigit(*s))
+        sec = sec * 10 + (*s++ - '0');
+    if(*s == '.'){
+        s++;
+        while(isdigit(*s)){
+            scale /= 10;
+            frac += (*s++ - '0') * scale;
+        }
+    }
+    return sec * 1000000000ll + frac;
+}
+
+// Appends all hex bytes of a line ("0x05, 0x01" or "05 01") to buf. Returns the new length.
+static int parse_hex(const char *s, unsigned char *buf, int len, int max)
+{
+    char *end;
+    unsigned long v;
+
+    while(*s){
+        if(!isxdigit(*s)){
+            s++;
+            continue;
+        }
+        v = strtoul(s, &end, 16);
+        if(end == s)
+            break;
+        if(len < max)
+            buf[len++] = v;
+        s = end;
+    }
+    return len;
+}
+
+// Timestamps are the ones of the capture, relative to its first packet. Without any, the packets arrive at the polling interval.
+static void process(struct packet *p)
+{
+    int btn, x, y, wheel, in_x, in_y, in_wheel, fields, status = 0;
+    u64 t0, t1, t2;
+
+    if(p->ts >= 0 && first_ts < 0)
+        first_ts = p->ts;
+    shim_now = p->ts >= 0 ? p->ts - first_ts : packets * interval_ns;
+    packets++;
+
+    t0 = timing ? now_ns() : 0;
+    fields = extract_mouse_events(p->data, p->len, &pos, &btn, &x, &y, &wheel);
+    t1 = timing ? now_ns() : 0;
+    in_x = x; in_y = y; in_wheel = wheel;
+
+    if(fields < 0){
+        rejected++;
+        status = fields;
+    } else if(fields & (REPORT_X | REPORT_Y | REPORT_WHEEL)){
+        status = accelerate(&state, &x, &y, &wheel);
+        if(status < 0){
+            failed++;
+            x = y = wheel = 0;
+        }
+    }
+    if(timing){
+        t2 = now_ns();
+        stage_add(&t_extract, t1 - t0);
+        if(fields >= 0)
+            stage_add(&t_accel, t2 - t1);
+    }
+
+    if(!quiet)
+        printf("%lld %d %d %d %d %d %d %d %d %d\n", shim_now, fields, btn, in_x, in_y, in_wheel, x, y, wheel, status);
+}
+
+// Loads the report descriptor, either from a usbhid-dump file (one or more "DESCRIPTOR" blocks) or from plain hex bytes
+static int load_descriptor(const char *path, int index)
+{
+    static unsigned char desc[MAX_DESCRIPTORS][MAX_DESCRIPTOR_SIZE];
+    int len[MAX_DESCRIPTORS] = {0}, num = 0, n, i;
+    char *line = NULL;
+    size_t cap = 0;
+    FILE *f = fopen(path, "r");
+
+    if(!f){
+        perror(path);
+        return -1;
+    }
+    while(getline(&line, &cap, f) >= 0){
+        if(strstr(line, ":DESCRIPTOR")){
+            if(len[num] && num < MAX_DESCRIPTORS - 1)
+                num++;
+            continue;
+        }
+        len[num] = parse_hex(line, desc[num], len[num], MAX_DESCRIPTOR_SIZE);
+    }
+    free(line);
+    fclose(f);
+    if(len[num])
+        num++;
+
+    for(n = 0; n < num; n++){
+        if(index >= 0 && n != index)
+            continue;
+        if(parse_report_desc(desc[n], len[n], &pos) < 0)
+            continue;
+        for(i = 0; i < pos.num_layouts; i++){
+            if(pos.layouts[i].fields & (REPORT_X | REPORT_Y))
+                return 0;
+        }
+    }
+    fprintf(stderr, "No report descriptor with mouse data found in %s\n", path);
+    return -1;
+}
+
+// Streams the capture. Every line holds one packet ("0x00, 0xff, ..."), optionally preceded by its timestamp in seconds.
+// usbhid-dump streams ("001:015:001:STREAM 1618165844.728901" followed by lines of hex bytes) are understood as well.
+static int replay(FILE *f)
+{
+    struct packet p = { .len = 0, .ts = -1 };
+    int in_block = 0;
+    char *line = NULL, *s;
+    size_t cap = 0;
+
+    while(getline(&line, &cap, f) >= 0){
+        for(s = line; isspace(*s); s++);
+
+        if(strstr(s, ":STREAM")){
+            if(in_block && p.len)
+                process(&p);
+            in_block = 1;
+            p.len = 0;
+            p.ts = parse_ts(strstr(s, ":STREAM") + 7 + strspn(strstr(s, ":STREAM") + 7, " \t"));
+            continue;
+        }
+        if(!*s || *s == '#'){
+            if(in_block && p.len)
+                process(&p);
+            in_block = 0;
+            continue;
+        }
+        if(in_block){
+            p.len = parse_hex(s, p.data, p.len, MAX_PACKET);
+            continue;
+        }
+
+        //A leading token with a dot (and without "0x") is the timestamp
+        p.ts = -1;
+        if(isdigit(s[0]) && s[1] != 'x' && strchr(s, '.') && strchr(s, '.') < s + strcspn(s, " \t,")){
+            p.ts = parse_ts(s);
+            s += strcspn(s, " \t");
+        }
+        p.len = parse_hex(s, p.data, 0, MAX_PACKET);
+        if(p.len)
+            process(&p);
+    }
+    if(in_block && p.len)
+        process(&p);
+    free(line);
+
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-e float|fixed|fallback] [-i n] [-u us] [-p name=value]... [-q] [-t] <descriptor> <capture|->\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *engine = "float";
+    char *params[32], *eq;
+    int num_params = 0, index = -1, opt, i;
+    FILE *f;
+    u64 start, total;
+
+    while((opt = getopt(argc, argv, "e:i:u:p:qt")) != -1){
+        switch(opt){
+        case 'e': engine = optarg; break;
+        case 'i': index = atoi(optarg); break;
+        case 'u': interval_ns = atoll(optarg) * NSEC_PER_USEC; break;
+        case 'p':
+            if(num_params < 32)
+                params[num_params++] = optarg;
+            break;
+        case 'q': quiet = 1; break;
+        case 't': timing = 1; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if(argc - optind != 2){
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(load_descriptor(argv[optind], index))
+        return 1;
+
+    //The engine and the parameters must be set before the first lookup table is built. Parameters only update, once set up as on module load.
+    accel_setup();
+    shim_fpu = strcmp(engine, "fallback") != 0;
+    shim_param_set("FixedPoint", strcmp(engine, "fixed") ? "0" : "1");
+    for(i = 0; i < num_params; i++){
+        eq = strchr(params[i], '=');
+        if(!eq){
+            usage(argv[0]);
+            return 1;
+        }
+        *eq = 0;
+        if(shim_param_set(params[i], eq + 1)){
+            fprintf(stderr, "Invalid parameter %s=%s\n", params[i], eq + 1);
+            return 1;
+        }
+    }
+    if(shim_param_set("update", "1")){
+        fprintf(stderr, "Invalid acceleration parameters\n");
+        return 1;
+    }
+    accel_init(&state, interval_ns / NSEC_PER_USEC);
+
+    f = strcmp(argv[optind + 1], "-") ? fopen(argv[optind + 1], "r") : stdin;
+    if(!f){
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    if(!quiet)
+        printf("# t_ns fields btn x y wheel out_x out_y out_wheel status\n");
+
+    start = now_ns();
+    replay(f);
+    total = now_ns() - start;
+    if(f != stdin)
+        fclose(f);
+
+    accel_release(&state);
+    accel_cleanup();
+
+    fprintf(stderr, "packets:    %ld (%ld rejected, %ld failed)\n", packets, rejected, failed);
+    fprintf(stderr, "throughput: %.0f packets/s (including I/O)\n", packets ? packets * 1e9 / total : 0.0);
+    if(timing && packets){
+        fprintf(stderr, "extract:    %.2f ns/packet (max %llu ns)\n", (double) t_extract.sum / packets, t_extract.max);
+        fprintf(stderr, "accelerate: %.2f ns/packet (max %llu ns)\n", (double) t_accel.sum / (packets - rejected ? packets - rejected : 1), t_accel.max);
+    }
+
+    return 0;
+}
@@ -0,0 +1,2 @@
+// Only used, if there is no driver/config.h yet
+#include "../../../driver/config.sample.h"
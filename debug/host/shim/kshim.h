@@ -0,0 +1,162 @@
+// Thin stand-in for the kernel headers used by driver/accel.c and driver/util.c, so both compile unmodified into a host library.
+// Everything the driver needs from the kernel is either mapped to libc or stubbed out. Never include <stdlib.h> here: Its atof() clashes with the one of the driver.
+#ifndef _KSHIM_H
+#define _KSHIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+
+// ########## Types
+typedef int8_t s8;      typedef uint8_t u8;
+typedef int16_t s16;    typedef uint16_t u16;
+typedef int32_t s32;    typedef uint32_t u32;
+typedef long long s64;  typedef unsigned long long u64;
+typedef s8 __s8;        typedef u8 __u8;
+typedef s16 __s16;      typedef u16 __u16;
+typedef s32 __s32;      typedef u32 __u32;
+typedef s64 __s64;      typedef u64 __u64;
+#define S32_MAX ((s32) 0x7fffffff)
+#define S32_MIN (-S32_MAX - 1)
+typedef s64 ktime_t;
+typedef long loff_t;        //As in <sys/types.h>, which the tools might include as well
+
+// ########## Compiler & misc
+#define KERNEL_VERSION(a,b,c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6,6,0)
+#define ____cacheline_aligned __attribute__((aligned(64)))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(volatile __typeof__(x) *) &(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *) &(x) = (v))
+#define smp_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+#define min_t(t, a, b) ((t) (a) < (t) (b) ? (t) (a) : (t) (b))
+#define max_t(t, a, b) ((t) (a) > (t) (b) ? (t) (a) : (t) (b))
+#define clamp_t(t, v, lo, hi) min_t(t, max_t(t, v, lo), hi)
+#define printk printf
+#define le16_to_cpu(x) (x)
+#define le32_to_cpu(x) (x)
+
+// ########## Memory (no <stdlib.h>, see above)
+void *malloc(size_t size);
+void *calloc(size_t nmemb, size_t size);
+void free(void *ptr);
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kzalloc(size, flags) calloc(1, size)
+#define kcalloc(n, size, flags) calloc(n, size)
+#define kfree(p) free(p)
+
+// ########## Unaligned little-endian access (the host is assumed to be little-endian, like x86)
+static inline u16 get_unaligned_le16(const void *p) { u16 v; memcpy(&v, p, 2); return v; }
+static inline u32 get_unaligned_le32(const void *p) { u32 v; memcpy(&v, p, 4); return v; }
+static inline void put_unaligned_le16(u16 v, void *p) { memcpy(p, &v, 2); }
+static inline void put_unaligned_le32(u32 v, void *p) { memcpy(p, &v, 4); }
+
+// ########## Math
+static inline s64 div64_s64(s64 a, s64 b) { return a / b; }
+static inline s64 div_s64(s64 a, s32 b) { return a / b; }
+static inline int fls64(u64 x) { return x ? 64 - __builtin_clzll(x) : 0; }
+
+// ########## Time. ktime_get() returns shim_now, unless it is negative. Then it falls back to CLOCK_MONOTONIC.
+#define NSEC_PER_USEC 1000L
+#define NSEC_PER_MSEC 1000000L
+#define USEC_PER_MSEC 1000L
+extern ktime_t shim_now;
+static inline ktime_t ktime_get(void)
+{
+    struct timespec t;
+
+    if(shim_now >= 0)
+        return shim_now;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ll + t.tv_nsec;
+}
+static inline u64 ktime_get_ns(void) { return ktime_get(); }
+#define ktime_sub(a, b) ((a) - (b))
+#define ktime_to_ns(t) (t)
+#define ktime_to_ms(t) ((t) / NSEC_PER_MSEC)
+
+// ########## FPU. irq_fpu_usable() returns shim_fpu, so the fixed-point fallback can be exercised as well.
+extern int shim_fpu;
+static inline bool irq_fpu_usable(void) { return shim_fpu; }
+static inline void kernel_fpu_begin(void) {}
+static inline void kernel_fpu_end(void) {}
+static inline void cond_resched(void) {}
+#ifndef noinline
+#define noinline __attribute__((noinline))
+#endif
+
+// ########## Work queues. Work runs right away, on the calling thread.
+struct work_struct { void (*func)(struct work_struct *); };
+#define INIT_WORK(w, f) ((w)->func = (f))
+static inline bool schedule_work(struct work_struct *w) { w->func(w); return true; }
+static inline bool cancel_work_sync(struct work_struct *w) { return false; }
+
+// ########## Locking & RCU. The host library is single threaded.
+struct mutex { int unused; };
+#define DEFINE_MUTEX(m) struct mutex m
+#define mutex_lock(m) ((void) (m))
+#define mutex_unlock(m) ((void) (m))
+#define lockdep_is_held(m) 1
+#define __rcu
+struct rcu_head { void *unused; };
+#define RCU_INITIALIZER(p) (p)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+#define rcu_read_lock() do {} while(0)
+#define rcu_read_unlock() do {} while(0)
+#define rcu_dereference(p) (p)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) ((p) = (v))
+#define synchronize_rcu() do {} while(0)
+#define rcu_barrier() do {} while(0)
+#define kfree_rcu(p, f) free(p)
+
+// ########## Module parameters. Every parameter is registered by name, so the host tools can set it via shim_param_set() just like writing to /sys/module/leetmouse/parameters.
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_PARM_DESC(name, desc)
+
+struct kernel_param;
+struct kernel_param_ops {
+    int (*set)(const char *val, const struct kernel_param *kp);
+    int (*get)(char *buffer, const struct kernel_param *kp);
+};
+struct kernel_param {
+    const char *name;
+    const struct kernel_param_ops *ops;
+    void *arg;
+    struct kernel_param *next;
+};
+
+int param_set_byte(const char *val, const struct kernel_param *kp);
+int param_get_byte(char *buffer, const struct kernel_param *kp);
+int param_set_charp(const char *val, const struct kernel_param *kp);
+int param_get_charp(char *buffer, const struct kernel_param *kp);
+extern const struct kernel_param_ops param_ops_byte;
+extern const struct kernel_param_ops param_ops_charp;
+void shim_param_register(struct kernel_param *kp);
+
+#define module_param_cb(_name, _ops, _arg, perm)                                        \
+    static struct kernel_param __param_##_name = { #_name, _ops, _arg, NULL };          \
+    static void __attribute__((constructor)) __param_register_##_name(void)             \
+    {                                                                                   \
+        shim_param_register(&__param_##_name);                                          \
+    }
+#define module_param_named(_name, value, type, perm) module_param_cb(_name, &param_ops_##type, &value, perm)
+
+#define THIS_MODULE NULL
+#define kernel_param_lock(mod) ((void) (mod))
+#define kernel_param_unlock(mod) ((void) (mod))
+
+// Sets a module parameter (e.g. "Acceleration" or "update") by its name. Returns -ENOENT for unknown parameters.
+int shim_param_set(const char *name, const char *val);
+
+#endif  //_KSHIM_H
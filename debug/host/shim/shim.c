@@ -0,0 +1,59 @@
+// Definitions behind kshim.h
+#include "kshim.h"
+
+ktime_t shim_now = -1;
+int shim_fpu = 1;
+
+static struct kernel_param *params = NULL;
+
+void shim_param_register(struct kernel_param *kp)
+{
+    kp->next = params;
+    params = kp;
+}
+
+int shim_param_set(const char *name, const char *val)
+{
+    struct kernel_param *kp;
+
+    for(kp = params; kp; kp = kp->next){
+        if(!strcmp(kp->name, name))
+            return kp->ops->set(val, kp);
+    }
+    return -ENOENT;
+}
+
+int param_set_byte(const char *val, const struct kernel_param *kp)
+{
+    int v;
+
+    if(sscanf(val, "%i", &v) != 1 || v < 0 || v > 255)
+        return -EINVAL;
+    *(char *) kp->arg = v;
+    return 0;
+}
+
+int param_get_byte(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%hhu\n", *(unsigned char *) kp->arg);
+}
+
+// Like the kernel, the string is copied. Copies are never freed, since the parameters live as long as the process.
+int param_set_charp(const char *val, const struct kernel_param *kp)
+{
+    char *copy = malloc(strlen(val) + 1);
+
+    if(!copy)
+        return -ENOMEM;
+    strcpy(copy, val);
+    *(char **) kp->arg = copy;
+    return 0;
+}
+
+int param_get_charp(char *buffer, const struct kernel_param *kp)
+{
+    return sprintf(buffer, "%s\n", *(char **) kp->arg);
+}
+
+const struct kernel_param_ops param_ops_byte = { param_set_byte, param_get_byte };
+const struct kernel_param_ops param_ops_charp = { param_set_charp, param_get_charp };
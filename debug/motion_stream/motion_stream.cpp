@@ -0,0 +1,80 @@
+// Follows the motion stream of a mouse (/dev/leetmouse_motion<n>, see driver/motion.h) and prints every record as CSV.
+// The records are read straight from the mapped ring. The tool only sleeps in poll(), once it caught up with the driver.
+// Build: g++ -O2 -o motion_stream motion_stream.cpp
+// Usage: sudo ./motion_stream [device] [records]
+#include <iostream>
+using namespace std;
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../../driver/motion.h"
+
+int main(int argc, char **argv)
+{
+    const char *path = argc > 1 ? argv[1] : "/dev/leetmouse_motion0";
+    long limit = argc > 2 ? atol(argv[2]) : -1, n = 0;
+    struct motion_header hdr;
+    struct pollfd pfd;
+    size_t len;
+    char *map;
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        cerr << "Cannot open " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    //The header tells, how large the ring is. Map it read-only first to learn the size, then the whole ring read/write (the tail is ours).
+    map = (char *) mmap(NULL, sizeof(hdr), PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "Cannot map " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    memcpy(&hdr, map, sizeof(hdr));
+    munmap(map, sizeof(hdr));
+    if (hdr.version != MOTION_VERSION || hdr.record_size != sizeof(struct motion_record)) {
+        cerr << "Unsupported motion stream version " << hdr.version << endl;
+        return 1;
+    }
+
+    len = hdr.offset + (size_t) hdr.size * hdr.record_size;
+    map = (char *) mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        cerr << "Cannot map " << path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    struct motion_header *h = (struct motion_header *) map;
+    struct motion_record *rec = (struct motion_record *) (map + h->offset);
+    unsigned int mask = h->size - 1;
+
+    printf("ts_ns,x,y,speed,sens,out_x,out_y\n");
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (limit < 0 || n < limit) {
+        unsigned int tail = h->tail;
+        unsigned int head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            fflush(stdout);
+            if (poll(&pfd, 1, -1) < 0 || (pfd.revents & POLLHUP))
+                break;      //The mouse is gone
+            continue;
+        }
+        for (; tail != head && (limit < 0 || n < limit); tail++, n++) {
+            const struct motion_record *r = &rec[tail & mask];
+            printf("%llu,%d,%d,%.4f,%.4f,%d,%d\n", (unsigned long long) r->ts, r->x, r->y, r->speed / 65536.0, r->sens / 65536.0, r->out_x, r->out_y);
+        }
+        __atomic_store_n(&h->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    cerr << n << " records, " << h->dropped << " dropped" << endl;
+    munmap(map, len);
+    close(fd);
+    return 0;
+}
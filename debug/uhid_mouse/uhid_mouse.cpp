@@ -0,0 +1,109 @@
+// Creates a virtual mouse via /dev/uhid and moves it. Lets you test the HID driver of leetmouse (hid_bind=1) without any real hardware.
+// Build: g++ -o uhid_mouse uhid_mouse.cpp
+// Usage: sudo ./uhid_mouse [dx] [dy] [packets] [interval in us]
+#include <iostream>
+using namespace std;
+
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/uhid.h>
+
+//Boot-protocol like mouse: 5 buttons, 16-bit X/Y and an 8-bit wheel. Same layout as the SteelSeries Rival 600 in hid_parser.h, minus its vendor-specific collections.
+static unsigned char rdesc[] = {
+    0x05, 0x01,         // Usage Page (Generic Desktop)
+    0x09, 0x02,         // Usage (Mouse)
+    0xA1, 0x01,         // Collection (Application)
+    0x09, 0x01,         //   Usage (Pointer)
+    0xA1, 0x00,         //   Collection (Physical)
+    0x05, 0x09,         //     Usage Page (Button)
+    0x19, 0x01,         //     Usage Minimum (1)
+    0x29, 0x05,         //     Usage Maximum (5)
+    0x15, 0x00,         //     Logical Minimum (0)
+    0x25, 0x01,         //     Logical Maximum (1)
+    0x95, 0x08,         //     Report Count (8)
+    0x75, 0x01,         //     Report Size (1)
+    0x81, 0x02,         //     Input (Data,Var,Abs)
+    0x05, 0x01,         //     Usage Page (Generic Desktop)
+    0x09, 0x30,         //     Usage (X)
+    0x09, 0x31,         //     Usage (Y)
+    0x16, 0x01, 0x80,   //     Logical Minimum (-32767)
+    0x26, 0xFF, 0x7F,   //     Logical Maximum (32767)
+    0x75, 0x10,         //     Report Size (16)
+    0x95, 0x02,         //     Report Count (2)
+    0x81, 0x06,         //     Input (Data,Var,Rel)
+    0x09, 0x38,         //     Usage (Wheel)
+    0x15, 0x81,         //     Logical Minimum (-127)
+    0x25, 0x7F,         //     Logical Maximum (127)
+    0x75, 0x08,         //     Report Size (8)
+    0x95, 0x01,         //     Report Count (1)
+    0x81, 0x06,         //     Input (Data,Var,Rel)
+    0xC0,               //   End Collection
+    0xC0                // End Collection
+};
+
+static int uhid_write(int fd, const struct uhid_event *ev)
+{
+    ssize_t ret = write(fd, ev, sizeof(*ev));
+
+    if(ret < 0){
+        cerr << "Cannot write to uhid: " << strerror(errno) << endl;
+        return -errno;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int dx = argc > 1 ? atoi(argv[1]) : 10;
+    int dy = argc > 2 ? atoi(argv[2]) : 0;
+    int packets = argc > 3 ? atoi(argv[3]) : 1000;
+    int interval = argc > 4 ? atoi(argv[4]) : 1000;
+    struct uhid_event ev;
+    int fd, i;
+
+    fd = open("/dev/uhid", O_RDWR | O_CLOEXEC);
+    if(fd < 0){
+        cerr << "Cannot open /dev/uhid: " << strerror(errno) << endl;
+        return 1;
+    }
+
+    //Pretend to be a USB mouse, so it shows up just like a real one
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_CREATE2;
+    strcpy((char*) ev.u.create2.name, "leetmouse uhid test mouse");
+    memcpy(ev.u.create2.rd_data, rdesc, sizeof(rdesc));
+    ev.u.create2.rd_size = sizeof(rdesc);
+    ev.u.create2.bus = BUS_USB;
+    ev.u.create2.vendor = 0x1d6b;
+    ev.u.create2.product = 0x0104;
+    if(uhid_write(fd, &ev))
+        return 1;
+
+    //Give the HID core (and udev) some time to bind a driver
+    sleep(1);
+
+    for(i = 0; i < packets; i++){
+        memset(&ev, 0, sizeof(ev));
+        ev.type = UHID_INPUT2;
+        ev.u.input2.size = 6;
+        ev.u.input2.data[0] = 0;                //Buttons
+        ev.u.input2.data[1] = dx & 0xff;        //X (little endian)
+        ev.u.input2.data[2] = (dx >> 8) & 0xff;
+        ev.u.input2.data[3] = dy & 0xff;        //Y
+        ev.u.input2.data[4] = (dy >> 8) & 0xff;
+        ev.u.input2.data[5] = 0;                //Wheel
+        if(uhid_write(fd, &ev))
+            break;
+        usleep(interval);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = UHID_DESTROY;
+    uhid_write(fd, &ev);
+    close(fd);
+
+    return 0;
+}
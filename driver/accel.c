@@ -3,11 +3,15 @@
 #include "accel.h"
 #include "util.h"
 #include "float.h"
+#include "fixedpoint.h"
 #include "config.h"
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/time.h>
 #include <linux/string.h>   //strlen
+#include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
 
 //Needed for kernel_fpu_begin/end
 #include <linux/version.h>
@@ -25,9 +29,69 @@ MODULE_AUTHOR("Klaus Zipfel <klaus (at) zipfel (dot) family>");         //Curren
 #define _s(x) #x
 #define s(x) _s(x)
 
+//Acceleration engine used, when "config.h" does not choose one: The floating point engine
+#ifndef FIXED_POINT
+#define FIXED_POINT 0
+#endif
+
+//Acceleration mode and the parameters of the non-linear modes, when "config.h" does not choose them: Linear, as the driver always did
+#ifndef ACCEL_MODE
+#define ACCEL_MODE 0
+#endif
+#ifndef EXPONENT
+#define EXPONENT 2.0f
+#endif
+#ifndef MIDPOINT
+#define MIDPOINT 5.0f
+#endif
+#ifndef GAIN
+#define GAIN 0
+#endif
+
+//Per-axis acceleration, rotation and angle snapping, when "config.h" does not choose them: Off
+#ifndef BY_COMPONENT
+#define BY_COMPONENT 0
+#endif
+#ifndef ANGLE_ADJUSTMENT
+#define ANGLE_ADJUSTMENT 0.0f
+#endif
+#ifndef ANGLE_SNAPPING
+#define ANGLE_SNAPPING 0.0f
+#endif
+
+//Curve of the Y axis, when it gets one of its own (BY_COMPONENT 2) and "config.h" does not choose it: The same as the one of the X axis
+#ifndef ACCELERATION_Y
+#define ACCELERATION_Y ACCELERATION
+#endif
+#ifndef SENS_CAP_Y
+#define SENS_CAP_Y SENS_CAP
+#endif
+#ifndef OFFSET_Y
+#define OFFSET_Y OFFSET
+#endif
+#ifndef EXPONENT_Y
+#define EXPONENT_Y EXPONENT
+#endif
+#ifndef MIDPOINT_Y
+#define MIDPOINT_Y MIDPOINT
+#endif
+
+//Shortest speed range (in counts/ms beyond the offset) covered by the sensitivity lookup table of a curve without a limit. Longer, if the curve straightens out only later (see lut_tail_range()).
+#ifndef LUT_RANGE
+#define LUT_RANGE 128.0f
+#endif
+//Curves, which have not flattened out up to this speed, are treated as if they never do. Way beyond anything a mouse can report.
+#define LUT_MAX_RANGE 65536.0f
+//Narrowest range of the table. Keeps the spacing of its entries representable in Q16.16.
+#define LUT_MIN_RANGE (1.0f / 64)
+//Curves without a limit are extrapolated linearly beyond the table. They must have become a straight line there: Their slope may change by this much at most.
+#define LUT_TAIL_TOL 1e-3f
+//Simpson steps per table entry, when integrating the gain (see lut_build_gain())
+#define LUT_GAIN_STEPS 8
+
 //Convenient helper for float based parameters, which are passed via a string to this module (must be individually parsed via atof() - available in util.c)
+//The strings are only parsed, when an update is triggered. Their values then end up in a new parameter snapshot (see below)
 #define PARAM_F(param, default, desc)                           \
-    float g_##param = default;                                  \
     static char* g_param_##param = s(default);                  \
     module_param_named(param, g_param_##param, charp, 0644);    \
     MODULE_PARM_DESC(param, desc);
@@ -37,15 +101,39 @@ MODULE_AUTHOR("Klaus Zipfel <klaus (at) zipfel (dot) family>");         //Curren
     module_param_named(param, g_##param, byte, 0644);           \
     MODULE_PARM_DESC(param, desc);
 
+//Same as PARAM, but can only be set when loading the module
+#define PARAM_RO(param, default, desc)                          \
+    static char g_##param = default;                            \
+    module_param_named(param, g_##param, byte, 0444);           \
+    MODULE_PARM_DESC(param, desc);
+
+//Same as PARAM, but calls "setter" whenever the parameter has been written to
+#define PARAM_CB(param, default, setter, desc)                  \
+    static char g_##param = default;                            \
+    static const struct kernel_param_ops param_ops_##param = {  \
+        .set = setter,                                          \
+        .get = param_get_byte,                                  \
+    };                                                          \
+    module_param_cb(param, &param_ops_##param, &g_##param, 0644); \
+    MODULE_PARM_DESC(param, desc);
+
+static int params_update(const char *val, const struct kernel_param *kp);
+
 // ########## Kernel module parameters
 
 // Simple module parameters (instant update)
 PARAM(no_bind,          0,              "This will disable binding to this driver via 'leetmouse_bind' by udev.");
-PARAM(update,           0,              "Triggers an update of the acceleration parameters below");
+PARAM_CB(update,        0,              params_update, "Triggers an update of the acceleration parameters below");
 
-//PARAM(AccelMode,        MODE,           "Acceleration method: 0 power law, 1: saturation, 2: log"); //Not yet implemented
+// Load-time module parameters
+PARAM_RO(FixedPoint,    FIXED_POINT,    "Use the fixed-point (integer only) acceleration engine, which never needs the FPU on the packet path. Updates and binding a mouse still use the FPU to build the lookup table.");
 
-// Acceleration parameters (type pchar. Converted to float via "updata_params" triggered by /sys/module/leetmouse/parameters/update)
+// Acceleration mode (applied with the next update, like the parameters below)
+PARAM(AccelMode,        ACCEL_MODE,     "Acceleration mode: 0 linear, 1 classic, 2 power, 3 natural, 4 jump, 5 synchronous, 6 custom curve (written to /sys/module/leetmouse/curve).");
+PARAM(ByComponent,      BY_COMPONENT,   "Accelerate X and Y separately, each by the sensitivity at its own speed, instead of both by the one at the speed of the motion. 2: Same, but the Y axis follows a curve of its own (the Y parameters).");
+PARAM(Gain,             GAIN,           "Treat the curve of the acceleration mode as gain (change of the output speed with the input speed) instead of sensitivity. Avoids jumps of the output speed, where the curve has kinks or steps.");
+
+// Acceleration parameters (type pchar. Converted to a parameter snapshot via "params_update" triggered by /sys/module/leetmouse/parameters/update)
 PARAM_F(PreScaleX,      PRE_SCALE_X,    "Prescale X-Axis before applying acceleration.");
 PARAM_F(PreScaleY,      PRE_SCALE_Y,    "Prescale Y-Axis before applying acceleration.");
 PARAM_F(SpeedCap,       SPEED_CAP,      "Limit the maximum pointer speed before applying acceleration.");
@@ -53,74 +141,882 @@ PARAM_F(Sensitivity,    SENSITIVITY,    "Mouse base sensitivity.");
 PARAM_F(Acceleration,   ACCELERATION,   "Mouse acceleration sensitivity.");
 PARAM_F(SensitivityCap, SENS_CAP,       "Cap maximum sensitivity.");
 PARAM_F(Offset,         OFFSET,         "Mouse base sensitivity.");
-//PARAM_F(Power,          XXX,            "");           //Not yet implemented
+PARAM_F(Exponent,       EXPONENT,       "Exponent of the classic and power modes.");
+PARAM_F(Midpoint,       MIDPOINT,       "Speed (counts/ms) of the step of the jump mode and the synchronous speed of the synchronous mode.");
+PARAM_F(AccelerationY,  ACCELERATION_Y, "Acceleration of the Y axis, if it follows a curve of its own (ByComponent 2).");
+PARAM_F(SensitivityCapY,SENS_CAP_Y,     "SensitivityCap of the Y axis, if it follows a curve of its own (ByComponent 2).");
+PARAM_F(OffsetY,        OFFSET_Y,       "Offset of the Y axis, if it follows a curve of its own (ByComponent 2).");
+PARAM_F(ExponentY,      EXPONENT_Y,     "Exponent of the Y axis, if it follows a curve of its own (ByComponent 2).");
+PARAM_F(MidpointY,      MIDPOINT_Y,     "Midpoint of the Y axis, if it follows a curve of its own (ByComponent 2).");
 PARAM_F(PostScaleX,     POST_SCALE_X,   "Postscale X-Axis after applying acceleration.");
 PARAM_F(PostScaleY,     POST_SCALE_Y,   "Postscale >-Axis after applying acceleration.");
-//PARAM_F(AngleAdjustment,XXX,            "");           //Not yet implemented. Douptful, if I will ever add it - Not very useful and needs me to implement trigonometric functions from scratch in C.
-//PARAM_F(AngleSnapping,  XXX,            "");           //Not yet implemented. Douptful, if I will ever add it - Not very useful and needs me to implement trigonometric functions from scratch in C.
+PARAM_F(AngleAdjustment,ANGLE_ADJUSTMENT,"Rotate the motion by this angle (degrees, clockwise on screen) after prescaling. Compensates for a sensor mounted at an angle.");
+PARAM_F(AngleSnapping,  ANGLE_SNAPPING, "Snap motion within this angle (degrees, below 45) of the horizontal or vertical axis onto it. 0 disables snapping.");
 PARAM_F(ScrollsPerTick, SCROLLS_PER_TICK,"Amount of lines to scroll per scroll-wheel tick.");
 
+//Acceleration modes. They only differ in the curve, the lookup table is built from (see curve()).
+enum accel_mode {
+    MODE_LINEAR,
+    MODE_CLASSIC,
+    MODE_POWER,
+    MODE_NATURAL,
+    MODE_JUMP,
+    MODE_SYNCHRONOUS,
+    MODE_CUSTOM
+};
+
+// ########## Parameter snapshots
+
+//A complete set of pre-parsed acceleration parameters, as floats and as fixed-point numbers.
+//Snapshots are never modified once published. Updates build a new snapshot outside of interrupt context and swap the pointer via RCU.
+//This way, accelerate() only needs a single pointer load per packet and never sees a half-updated set of parameters.
+#define PARAM_FIELD(param) float param; fixedpt fp_##param;
+struct accel_params {
+    PARAM_FIELD(PreScaleX)
+    PARAM_FIELD(PreScaleY)
+    PARAM_FIELD(SpeedCap)
+    PARAM_FIELD(Sensitivity)
+    PARAM_FIELD(Acceleration)
+    PARAM_FIELD(SensitivityCap)
+    PARAM_FIELD(Offset)
+    PARAM_FIELD(PostScaleX)
+    PARAM_FIELD(PostScaleY)
+    PARAM_FIELD(ScrollsPerTick)
+    PARAM_FIELD(Exponent)
+    PARAM_FIELD(Midpoint)
+    PARAM_FIELD(AngleAdjustment)
+    PARAM_FIELD(AngleSnapping)
+    PARAM_FIELD(AccelerationY)
+    PARAM_FIELD(SensitivityCapY)
+    PARAM_FIELD(OffsetY)
+    PARAM_FIELD(ExponentY)
+    PARAM_FIELD(MidpointY)
+    //Derived from the angles, when the snapshot is built (see params_derive()): The rotation matrix and the threshold of the snapping
+    PARAM_FIELD(RotCos)
+    PARAM_FIELD(RotSin)
+    PARAM_FIELD(SnapTan)
+    unsigned char Rotate;
+    unsigned char AccelMode;
+    unsigned char ByComponent;
+    unsigned char Gain;
+    unsigned int CurvePoints;
+    struct accel_point Curve[ACCEL_CURVE_MAX];
+    //Curve of the Y axis: With ByComponent 2, a copy of this snapshot with the Y parameters in place of the ones of the X axis (see params_axis_y()). Otherwise the snapshot itself.
+    const struct accel_params *axis_y;
+    unsigned int gen;           //Incremented with every snapshot, so each device knows when its lookup table is outdated
+    struct rcu_head rcu;
+};
+
+//The snapshot we start with. Holds the values from "config.h" and is never freed.
+#define PARAM_DEFAULT(param, default) .param = default, .fp_##param = FP_CONST(default)
+static struct accel_params g_params_default = {
+    PARAM_DEFAULT(PreScaleX,        PRE_SCALE_X),
+    PARAM_DEFAULT(PreScaleY,        PRE_SCALE_Y),
+    PARAM_DEFAULT(SpeedCap,         SPEED_CAP),
+    PARAM_DEFAULT(Sensitivity,      SENSITIVITY),
+    PARAM_DEFAULT(Acceleration,     ACCELERATION),
+    PARAM_DEFAULT(SensitivityCap,   SENS_CAP),
+    PARAM_DEFAULT(Offset,           OFFSET),
+    PARAM_DEFAULT(PostScaleX,       POST_SCALE_X),
+    PARAM_DEFAULT(PostScaleY,       POST_SCALE_Y),
+    PARAM_DEFAULT(ScrollsPerTick,   SCROLLS_PER_TICK),
+    PARAM_DEFAULT(Exponent,         EXPONENT),
+    PARAM_DEFAULT(Midpoint,         MIDPOINT),
+    PARAM_DEFAULT(AngleAdjustment,  ANGLE_ADJUSTMENT),
+    PARAM_DEFAULT(AngleSnapping,    ANGLE_SNAPPING),
+    PARAM_DEFAULT(AccelerationY,    ACCELERATION_Y),
+    PARAM_DEFAULT(SensitivityCapY,  SENS_CAP_Y),
+    PARAM_DEFAULT(OffsetY,          OFFSET_Y),
+    PARAM_DEFAULT(ExponentY,        EXPONENT_Y),
+    PARAM_DEFAULT(MidpointY,        MIDPOINT_Y),
+    .AccelMode = ACCEL_MODE,
+    .ByComponent = BY_COMPONENT,
+    .Gain = GAIN,
+    .axis_y = &g_params_default,
+    //Neither rotation nor snapping, until accel_setup() derived them from the angles above. Same for a curve of the Y axis.
+};
+static struct accel_params g_params_default_y;
+
+static struct accel_params __rcu *g_params = RCU_INITIALIZER(&g_params_default);
+static DEFINE_MUTEX(g_params_lock);     //Serializes writers
+
+//The custom curve, as written to sysfs. Copied into the next snapshot.
+static struct accel_point g_curve[ACCEL_CURVE_MAX];
+static size_t g_curve_bytes;
+static DEFINE_MUTEX(g_curve_lock);
 
-// Updates the acceleration parameters. This is purposely done with a delay!
-// First, to not hammer too much the logic in "accelerate()", which is called VERY OFTEN!
-// Second, to fight possible cheating. However, this can be OFC changed, since we are OSS...
-#define PARAM_UPDATE(param) atof(g_param_##param, strlen(g_param_##param) , &g_##param);
+#define PARAM_PARSE(param) atof(g_param_##param, strlen(g_param_##param), &p->param)
+#define PARAM_PARSE_FIXED(param) atofp(g_param_##param, strlen(g_param_##param), &p->fp_##param)
 
-static ktime_t g_next_update = 0;
-INLINE void updata_params(ktime_t now)
+// Checks the points of a custom curve: At least one, ascending speeds within the range of the lookup table and sensitivities within the range of Q16.16.
+// Written this way round, NaN fails every comparison.
+INLINE int curve_valid(const struct accel_params *p)
 {
-    if(!g_update) return;
-    if(now < g_next_update) return;
+    float prev = 0;
+    unsigned int i;
+
+    if(!p->CurvePoints)
+        return 0;
+    for(i = 0; i < p->CurvePoints; i++){
+        if(!(p->Curve[i].speed >= prev && p->Curve[i].speed <= LUT_MAX_RANGE))
+            return 0;
+        if(i && !(p->Curve[i].speed > prev))
+            return 0;
+        if(!(p->Curve[i].sens >= 0 && p->Curve[i].sens < 32767.0f))
+            return 0;
+        prev = p->Curve[i].speed;
+    }
+    return 1;
+}
+
+INLINE float lut_tail_range(const struct accel_params *p);
+
+// Checks, whether the curve of the chosen mode is well-defined. The modes approaching SensitivityCap need one.
+// The modes, which can do without, need one as well, unless their curve ends in a straight line (see lut_tail_range()).
+// Written this way round, NaN fails the checks of the angles.
+INLINE int params_valid(const struct accel_params *p)
+{
+    if(!(p->AngleAdjustment >= -360.0f && p->AngleAdjustment <= 360.0f))
+        return 0;
+    if(!(p->AngleSnapping >= 0 && p->AngleSnapping < 45.0f))
+        return 0;
+    //0: Off, 1: By component, 2: By component, with a curve of its own for the Y axis
+    if(p->ByComponent > 2)
+        return 0;
+    switch(p->AccelMode){
+    case MODE_LINEAR:
+        return p->SensitivityCap > 0 || lut_tail_range(p) > 0;
+    case MODE_CLASSIC:
+        return p->Exponent >= 1 && (p->SensitivityCap > 0 || lut_tail_range(p) > 0);
+    case MODE_POWER:
+        return p->Exponent >= 0 && (p->SensitivityCap > 0 || lut_tail_range(p) > 0);
+    case MODE_NATURAL:
+    case MODE_JUMP:
+        return p->SensitivityCap > 0;
+    case MODE_SYNCHRONOUS:
+        return p->SensitivityCap > 0 && p->Sensitivity > 0 && p->Midpoint > 0;
+    case MODE_CUSTOM:
+        return curve_valid(p);
+    }
+    return 0;
+}
+
+// Derives the rotation matrix and the threshold of the angle snapping from their angles, so the packet path only needs a 2x2 multiplication and a compare.
+// Must be called within kernel_fpu_begin()/kernel_fpu_end()
+INLINE void params_derive(struct accel_params *p)
+{
+    float s, c;
+
+    Leet_sincos(&p->AngleAdjustment, &p->RotSin, &p->RotCos);
+    p->Rotate = p->AngleAdjustment != 0;
+    //Motion snaps onto an axis, when the other component is at most SnapTan times as large
+    Leet_sincos(&p->AngleSnapping, &s, &c);
+    p->SnapTan = s / c;
+
+    p->fp_RotCos = Leet_to_fixed(&p->RotCos);
+    p->fp_RotSin = Leet_to_fixed(&p->RotSin);
+    p->fp_SnapTan = Leet_to_fixed(&p->SnapTan);
+}
+
+// Sets up the curve of the Y axis (ByComponent 2): A copy of the snapshot p, with the Y parameters in place of the ones of the X axis.
+// So checking the curve and building its table works just the same as for the X axis. Must be called within kernel_fpu_begin()/kernel_fpu_end()
+#define PARAM_AXIS_Y(param) y->param = p->param##Y; y->fp_##param = p->fp_##param##Y;
+INLINE void params_axis_y(struct accel_params *y, struct accel_params *p)
+{
+    memcpy(y, p, sizeof(struct accel_params));
+    PARAM_AXIS_Y(Acceleration)
+    PARAM_AXIS_Y(SensitivityCap)
+    PARAM_AXIS_Y(Offset)
+    PARAM_AXIS_Y(Exponent)
+    PARAM_AXIS_Y(Midpoint)
+    y->axis_y = y;
+    p->axis_y = y;
+}
+
+// Parses all string parameters into the snapshot p. y is room for the curve of the Y axis, in case it has one of its own.
+// Both engines need the float values: Whatever the engine, the lookup tables are built from them.
+static int params_parse(struct accel_params *p, struct accel_params *y)
+{
+    int ret = 0;
+
+    ret |= PARAM_PARSE_FIXED(PreScaleX);
+    ret |= PARAM_PARSE_FIXED(PreScaleY);
+    ret |= PARAM_PARSE_FIXED(SpeedCap);
+    ret |= PARAM_PARSE_FIXED(Sensitivity);
+    ret |= PARAM_PARSE_FIXED(Acceleration);
+    ret |= PARAM_PARSE_FIXED(SensitivityCap);
+    ret |= PARAM_PARSE_FIXED(Offset);
+    ret |= PARAM_PARSE_FIXED(PostScaleX);
+    ret |= PARAM_PARSE_FIXED(PostScaleY);
+    ret |= PARAM_PARSE_FIXED(ScrollsPerTick);
+    ret |= PARAM_PARSE_FIXED(Exponent);
+    ret |= PARAM_PARSE_FIXED(Midpoint);
+    ret |= PARAM_PARSE_FIXED(AngleAdjustment);
+    ret |= PARAM_PARSE_FIXED(AngleSnapping);
+    ret |= PARAM_PARSE_FIXED(AccelerationY);
+    ret |= PARAM_PARSE_FIXED(SensitivityCapY);
+    ret |= PARAM_PARSE_FIXED(OffsetY);
+    ret |= PARAM_PARSE_FIXED(ExponentY);
+    ret |= PARAM_PARSE_FIXED(MidpointY);
+    p->AccelMode = g_AccelMode;
+    p->ByComponent = g_ByComponent;
+    p->Gain = g_Gain;
+    //-ERANGE only, if nothing but values out of range failed. The error codes are OR'ed together above.
+    if(ret)
+        return ret == -ERANGE ? -ERANGE : -EINVAL;
+
+    //Just the bits for now. They are checked along with the float parameters.
+    mutex_lock(&g_curve_lock);
+    memcpy(p->Curve, g_curve, g_curve_bytes);
+    //A curve cut off within a point is no curve at all
+    p->CurvePoints = g_curve_bytes % sizeof(struct accel_point) ? 0 : g_curve_bytes / sizeof(struct accel_point);
+    mutex_unlock(&g_curve_lock);
+
+    //We are in process context here, so the FPU is always usable
+kernel_fpu_begin();
+    ret |= PARAM_PARSE(PreScaleX);
+    ret |= PARAM_PARSE(PreScaleY);
+    ret |= PARAM_PARSE(SpeedCap);
+    ret |= PARAM_PARSE(Sensitivity);
+    ret |= PARAM_PARSE(Acceleration);
+    ret |= PARAM_PARSE(SensitivityCap);
+    ret |= PARAM_PARSE(Offset);
+    ret |= PARAM_PARSE(PostScaleX);
+    ret |= PARAM_PARSE(PostScaleY);
+    ret |= PARAM_PARSE(ScrollsPerTick);
+    ret |= PARAM_PARSE(Exponent);
+    ret |= PARAM_PARSE(Midpoint);
+    ret |= PARAM_PARSE(AngleAdjustment);
+    ret |= PARAM_PARSE(AngleSnapping);
+    ret |= PARAM_PARSE(AccelerationY);
+    ret |= PARAM_PARSE(SensitivityCapY);
+    ret |= PARAM_PARSE(OffsetY);
+    ret |= PARAM_PARSE(ExponentY);
+    ret |= PARAM_PARSE(MidpointY);
+    if(!ret && !params_valid(p))
+        ret = -EINVAL;
+    if(!ret)
+        params_derive(p);
+    //The curve of the Y axis has to be well-defined as well
+    p->axis_y = p;
+    if(!ret && p->ByComponent == 2){
+        params_axis_y(y, p);
+        if(!params_valid(y))
+            ret = -EINVAL;
+    }
+kernel_fpu_end();
+
+    return ret ? -EINVAL : 0;
+}
+
+// Swaps in a new snapshot. The old one is freed, once no reader can see it anymore.
+static void params_publish(struct accel_params *p)
+{
+    struct accel_params *old;
+
+    mutex_lock(&g_params_lock);
+    old = rcu_dereference_protected(g_params, lockdep_is_held(&g_params_lock));
+    p->gen = old->gen + 1;
+    rcu_assign_pointer(g_params, p);
+    mutex_unlock(&g_params_lock);
+
+    if(old != &g_params_default)
+        kfree_rcu(old, rcu);
+}
+
+// Builds a complete snapshot from the string parameters and publishes it. The new parameters apply with the very next packet.
+// Invalid parameters are rejected as a whole and the current snapshot stays in place. The module parameter lock must be held, so none of the string parameters can change while we parse them.
+static int params_apply(void)
+{
+    struct accel_params *p;
+    int ret;
+
+    //Along with the room for a curve of the Y axis. So the snapshot stays a single allocation, freed as a whole.
+    p = kcalloc(2, sizeof(struct accel_params), GFP_KERNEL);
+    if(!p)
+        return -ENOMEM;
+
+    ret = params_parse(p, p + 1);
+    if(ret){
+        printk("LEETMOUSE: Invalid acceleration parameters. Keeping the current ones");
+        kfree(p);
+        return ret;
+    }
+
+    params_publish(p);
+    return 0;
+}
+
+//Set by accel_setup(). Until then, the default snapshot is not complete yet, so an update has to wait.
+static bool g_setup = false;
+
+// Called, when /sys/module/leetmouse/parameters/update is written to. Note: The module parameter lock is held here.
+// On the command line of insmod, it is called before the module's init, in the order of the parameters. So the update is left pending there and accel_setup() applies it,
+// after all the other parameters have been set.
+static int params_update(const char *val, const struct kernel_param *kp)
+{
+    int ret;
+
+    ret = param_set_byte(val, kp);
+    if(ret || !g_update || !g_setup)
+        return ret;
     g_update = 0;
-    g_next_update = now + 1000000000ll;    //Next update is allowed after 1s of delay
 
-    PARAM_UPDATE(PreScaleX);
-    PARAM_UPDATE(PreScaleY);
-    PARAM_UPDATE(SpeedCap);
-    PARAM_UPDATE(Sensitivity);
-    PARAM_UPDATE(Acceleration);
-    PARAM_UPDATE(SensitivityCap);
-    PARAM_UPDATE(Offset);
-    PARAM_UPDATE(PostScaleX);
-    PARAM_UPDATE(PostScaleY);
-    PARAM_UPDATE(ScrollsPerTick);
+    return params_apply();
+}
+
+// Derives what cannot be computed at compile time for the snapshot from "config.h". Called on module load, before any device is bound.
+// Then applies an update requested on the command line of insmod (see params_update()).
+void accel_setup(void)
+{
+    kernel_fpu_begin();
+    params_derive(&g_params_default);
+    if(g_params_default.ByComponent == 2)
+        params_axis_y(&g_params_default_y, &g_params_default);
+    kernel_fpu_end();
+
+    //The parameters are writable via sysfs already, so this might race with an update from there
+    kernel_param_lock(THIS_MODULE);
+    g_setup = true;
+    if(g_update){
+        g_update = 0;
+        params_apply();
+    }
+    kernel_param_unlock(THIS_MODULE);
+}
+
+// Frees the last published snapshot. Called on module unload, after all devices are gone.
+void accel_cleanup(void)
+{
+    struct accel_params *p = rcu_dereference_protected(g_params, 1);
+
+    RCU_INIT_POINTER(g_params, &g_params_default);
+    if(p != &g_params_default)
+        kfree_rcu(p, rcu);
+    rcu_barrier();
+}
+
+// ########## Custom curve
+
+// Reads back the custom curve, as it was written
+ssize_t accel_curve_read(char *buf, loff_t off, size_t count)
+{
+    mutex_lock(&g_curve_lock);
+    if(off >= g_curve_bytes)
+        count = 0;
+    else
+        count = min_t(size_t, count, g_curve_bytes - off);
+    memcpy(buf, (char *) g_curve + off, count);
+    mutex_unlock(&g_curve_lock);
+    return count;
+}
+
+// Stages (part of) a custom curve. A write at offset 0 starts a new curve, larger ones are continued by writes at the end of the previous ones.
+// The points are only checked, when an update applies them: Until then, it does not matter whether they arrived in one piece.
+ssize_t accel_curve_write(const char *buf, loff_t off, size_t count)
+{
+    mutex_lock(&g_curve_lock);
+    if(off == 0)
+        g_curve_bytes = 0;
+    if(off != g_curve_bytes || off + count > sizeof(g_curve)){
+        mutex_unlock(&g_curve_lock);
+        return -EINVAL;
+    }
+    memcpy((char *) g_curve + off, buf, count);
+    g_curve_bytes += count;
+    mutex_unlock(&g_curve_lock);
+    return count;
+}
+
+// ########## Frametime
+
+// Calculates the frametime in ns since the last packet of this device. Integer only, so both engines can use it.
+// While the mouse moves, packets arrive at the polling rate. Their intervals are fed into a moving average, which irons out the jitter of the USB stack.
+// This estimate is then used as frametime, so 2/4/8 kHz mice get the correct rate, without sub-millisecond jitter showing up in the acceleration.
+#define FRAMETIME_MAX_NS (100 * NSEC_PER_MSEC)     //Original InterAccel has 200 ms here. RawAccel rounds to 100 ms. So do we.
+INLINE s64 frametime_ns(struct accel_state *state, ktime_t now)
+{
+    s64 ns = ktime_to_ns(ktime_sub(now, state->last));
+    s64 prev = state->last_ns;
+    s64 est = state->frametime_ns;
+    s64 sample = ns;
+
+    state->last = now;
+    state->last_ns = ns;
+
+    //Update the estimate from regular packets. Outliers are clamped, so a single bunch only moves the estimate by a fraction.
+    if(ns <= est * 2){
+        if(sample < est / 2) sample = est / 2;
+        est += (sample - est) >> 3;
+    //Two consecutive, similar intervals longer than expected: The mouse reports slower than the estimate (e.g. slower than the endpoint's interval). Start over from there.
+    //A single long interval is the first packet after the mouse rested and is left out.
+    } else if(ns <= prev * 2 && prev <= ns * 2 && ns <= FRAMETIME_MAX_NS) {
+        est = ns;
+    }
+    if(est < state->interval_ns) est = state->interval_ns;         //The host never polls faster than the endpoint's interval
+    state->frametime_ns = est;
+
+    //Sometimes, urbs appear bunched -> The timing reading is plain wrong. Fallback to the estimate. Same for any regular packet, so the jitter does not show up.
+    if(ns <= est * 2) return est;
+    //The mouse rested before this packet (or the estimate still converges): Take the measured frametime
+    if(ns > FRAMETIME_MAX_NS) ns = FRAMETIME_MAX_NS;
+    return ns;
+}
+
+// ########## Sensitivity curves
+
+// Sensitivity of the chosen mode at a given rate (offset already subtracted). Linear, classic and power still need to be capped.
+// Curves are only ever evaluated while building the lookup table: The packet path does the same table lookup, whatever the mode.
+// So they can afford the accurate arithmetic of float.h. Must be called within kernel_fpu_begin()/kernel_fpu_end()
+INLINE float curve(const struct accel_params *p, float rate)
+{
+    float s = p->Sensitivity, span = p->SensitivityCap - p->Sensitivity, t, u;
+
+    if(rate < 0)
+        rate = 0;
+    switch(p->AccelMode){
+    //Quake's cl_mouseaccel_power: Sensitivity + (Acceleration * rate)^(Exponent - 1). An Exponent of 2 is the linear curve.
+    case MODE_CLASSIC:
+        t = p->Acceleration * rate;
+        u = p->Exponent - 1.0f;
+        Leet_pow(&t, &u);
+        return s + t;
+    //Sensitivity * (1 + Acceleration * rate)^Exponent
+    case MODE_POWER:
+        t = 1.0f + p->Acceleration * rate;
+        u = p->Exponent;
+        Leet_pow(&t, &u);
+        return s * t;
+    //Approaches SensitivityCap smoothly: Sensitivity + (SensitivityCap - Sensitivity) * (1 - e^(-Acceleration * rate))
+    case MODE_NATURAL:
+        t = -p->Acceleration * rate;
+        Leet_exp(&t);
+        return s + span * (1.0f - t);
+    //Steps from Sensitivity to SensitivityCap at Midpoint. An Acceleration above 0 smoothes the step into a logistic curve of that steepness.
+    case MODE_JUMP:
+        if(p->Acceleration <= 0)
+            return rate < p->Midpoint ? s : p->SensitivityCap;
+        t = -p->Acceleration * (rate - p->Midpoint);
+        Leet_exp(&t);
+        return s + span / (1.0f + t);
+    //Symmetric in log space around Midpoint, ranging from Sensitivity / r to Sensitivity * r with r = SensitivityCap / Sensitivity:
+    //Sensitivity * r^tanh(Acceleration * ln(rate / Midpoint))
+    case MODE_SYNCHRONOUS:
+        if(rate > 0){
+            t = rate / p->Midpoint;
+            Leet_log(&t);
+            t *= 2.0f * p->Acceleration;
+            if(t > 80.0f) t = 80.0f;
+            Leet_exp(&t);
+            t = 1.0f - 2.0f / (t + 1.0f);       //tanh(Acceleration * ln(rate / Midpoint))
+        } else {
+            t = p->Acceleration > 0 ? -1.0f : 0.0f;
+        }
+        u = p->SensitivityCap / s;
+        Leet_log(&u);
+        t *= u;
+        Leet_exp(&t);
+        return s * t;
+    //Sensitivity + Acceleration * rate
+    default:
+        return s + p->Acceleration * rate;
+    }
+}
+
+// Custom curve at a given rate: Linear interpolation between its points (already relative to the base sensitivity, see accel.h)
+// Without any points (only possible in the snapshot from "config.h"), the sensitivity stays untouched.
+INLINE float custom_curve(const struct accel_params *p, float rate)
+{
+    const struct accel_point *pt = p->Curve;
+    unsigned int lo = 0, hi = p->CurvePoints - 1, mid;
+
+    if(!p->CurvePoints)
+        return 1.0f;
+    if(rate <= pt[0].speed)
+        return pt[0].sens;
+    if(rate >= pt[hi].speed)
+        return pt[hi].sens;
+    //Find the segment [lo, hi] holding rate
+    while(hi - lo > 1){
+        mid = (lo + hi) / 2;
+        if(rate < pt[mid].speed)
+            hi = mid;
+        else
+            lo = mid;
+    }
+    return pt[lo].sens + (rate - pt[lo].speed) * (pt[hi].sens - pt[lo].sens) / (pt[hi].speed - pt[lo].speed);
+}
+
+// Sensitivity at a given rate (offset already subtracted), relative to the base sensitivity
+INLINE float sens_curve(const struct accel_params *p, float rate)
+{
+    float accel_sens;
+
+    if(p->AccelMode == MODE_CUSTOM)
+        return custom_curve(p, rate);
+    if(p->Sensitivity == 0)             //The curve is relative to the base sensitivity. Leave the sensitivity untouched instead of dividing by zero
+        return 1.0f;
+    accel_sens = curve(p, rate);
+    //For the other modes, SensitivityCap is the target of the curve rather than a cap
+    if(p->AccelMode <= MODE_POWER && p->SensitivityCap > 0 && accel_sens >= p->SensitivityCap)
+        accel_sens = p->SensitivityCap;
+    return accel_sens / p->Sensitivity;
+}
+
+// The relative sensitivity the curve flattens out at for high speeds (its cap or its asymptote). Returns 0, if it never does.
+INLINE int curve_limit(const struct accel_params *p, float *limit)
+{
+    if(p->Sensitivity == 0)
+        return 0;
+    switch(p->AccelMode){
+    case MODE_NATURAL:
+    case MODE_JUMP:
+    case MODE_SYNCHRONOUS:
+        *limit = p->SensitivityCap / p->Sensitivity;
+        return 1;
+    }
+    if(p->SensitivityCap > 0){
+        *limit = p->SensitivityCap / p->Sensitivity;
+        return 1;
+    }
+    return 0;
+}
+
+// A rebuild evaluates the curve some 10k times (most of them estimating errors in lut_range()), too long to keep preemption off all along.
+// So every loop over the table leaves the FPU section after each LUT_BATCH entries, to give the CPU away if needed.
+#define LUT_BATCH 32
+
+// Leaves the FPU section for a moment. noinline, so the compiler cannot move any float arithmetic of the caller in between.
+// Must be called within kernel_fpu_begin()/kernel_fpu_end(), from process context. The snapshot must not go away meanwhile (see lut_update()).
+static noinline void lut_resched(void)
+{
+    kernel_fpu_end();
+    cond_resched();
+    kernel_fpu_begin();
+}
+
+// Largest relative error of interpolating the curve from a table over [0, range], estimated at the midpoints between the entries. Might sleep (see lut_resched()).
+INLINE float lut_error(const struct accel_params *p, float range)
+{
+    float step = range / (ACCEL_LUT_SIZE - 1), a = sens_curve(p, 0), b, m, err, max = 0;
+    int i;
+
+    for(i = 1; i < ACCEL_LUT_SIZE; i++){
+        if(!(i % LUT_BATCH))
+            lut_resched();
+        b = sens_curve(p, step * i);
+        m = sens_curve(p, step * (i - 0.5f));
+        err = (a + b) * 0.5f - m;
+        if(err < 0) err = -err;
+        if(m > 0 && err > max * m)
+            max = err / m;
+        a = b;
+    }
+    return max;
+}
+
+// Finds the speed, beyond which the curve is a straight line, i.e. its slope over [range, 2 * range] and [2 * range, 4 * range] differs by LUT_TAIL_TOL at most.
+// Returns 0 for curves, which do not straighten out up to LUT_MAX_RANGE, e.g. classic curves with an exponent other than 2: Their slope keeps changing by the same ratio at any scale.
+// Differences within the float resolution of the curve count as straight.
+INLINE float lut_tail_range(const struct accel_params *p)
+{
+    float range, a, b, c, d;
+
+    for(range = LUT_RANGE; range <= LUT_MAX_RANGE; range *= 2.0f){
+        a = sens_curve(p, range);
+        b = sens_curve(p, 2.0f * range);
+        c = sens_curve(p, 4.0f * range);
+        d = (c - b) * 0.5f - (b - a);
+        if(d < 0) d = -d;
+        if(d <= LUT_TAIL_TOL * (b > a ? b - a : a - b) || d <= 1e-6f * (c < 0 ? -c : c))
+            return range;
+    }
+    return 0;
+}
+
+// Speed range covered by the table. For curves with a limit, the table is flat beyond: It reaches up to where the curve got within 1e-4 of the way to its limit.
+// If the table gets too coarse that way (e.g. for curves, which approach their limit very slowly), it is shortened as long as this lowers the overall error.
+// Curves without a limit get the range, from which on they are a straight line, and are extrapolated beyond (params_valid() rejects the others).
+// Curves reaching their limit only beyond LUT_MAX_RANGE are treated alike, if they straighten out before. Otherwise their table covers all up to LUT_MAX_RANGE. Sets *flat for curves with a limit.
+// Might sleep (see lut_resched()).
+INLINE float lut_range(const struct accel_params *p, int *flat)
+{
+    float limit, tol, lo, hi, mid, d, err, best_err;
+    int i;
+
+    //A custom curve is constant beyond its last point. The table covers all of them.
+    if(p->AccelMode == MODE_CUSTOM){
+        *flat = 1;
+        hi = p->CurvePoints ? p->Curve[p->CurvePoints - 1].speed : 0;
+        return hi > LUT_MIN_RANGE ? hi : LUT_MIN_RANGE;
+    }
+
+    *flat = 0;
+    if(!curve_limit(p, &limit)){
+        hi = lut_tail_range(p);
+        return hi > 0 ? hi : LUT_RANGE;
+    }
+    tol = limit - sens_curve(p, 0);
+    tol = (tol < 0 ? -tol : tol) * 1e-4f;
+
+    //Find a rate, where the curve got there. Then narrow it down by bisection.
+    for(hi = LUT_MIN_RANGE; hi <= LUT_MAX_RANGE; hi *= 2.0f){
+        d = sens_curve(p, hi) - limit;
+        if(d <= tol && d >= -tol)
+            break;
+    }
+    if(hi > LUT_MAX_RANGE){
+        hi = lut_tail_range(p);
+        return hi > 0 ? hi : LUT_MAX_RANGE;
+    }
+    *flat = 1;
+    if(hi == LUT_MIN_RANGE)
+        return hi;
+    lo = hi * 0.5f;
+    for(i = 0; i < 24; i++){
+        mid = (lo + hi) * 0.5f;
+        d = sens_curve(p, mid) - limit;
+        if(d <= tol && d >= -tol)
+            hi = mid;
+        else
+            lo = mid;
+    }
+
+    //Beyond a shorter table, the error is the distance of the curve to its limit. Within, it is the error of the interpolation.
+    best_err = lut_error(p, hi);
+    for(mid = hi * 0.8f; mid >= LUT_MIN_RANGE; mid *= 0.8f){
+        d = (sens_curve(p, mid) - limit) / limit;
+        if(d < 0) d = -d;
+        err = lut_error(p, mid);
+        if(d > err) err = d;
+        if(err >= best_err)
+            break;
+        hi = mid;
+        best_err = err;
+    }
+    return hi;
+}
+
+// ########## Sensitivity lookup table
+
+// Integral of the curve over [a, b] by Simpson's rule. Must be called within kernel_fpu_begin()/kernel_fpu_end()
+INLINE float curve_integral(const struct accel_params *p, float a, float b)
+{
+    float h = (b - a) / LUT_GAIN_STEPS, sum = sens_curve(p, a) + sens_curve(p, b);
+    int i;
+
+    for(i = 1; i < LUT_GAIN_STEPS; i++)
+        sum += (i & 1 ? 4.0f : 2.0f) * sens_curve(p, a + h * i);
+    return sum * h / 3.0f;
+}
+
+// Gain: The curve is the change of the output speed with the speed, so the output speed is its integral. Integrated once here, the table holds
+// the output speed divided by the speed, which is a sensitivity again. That way, the packet path stays the same. The table's range follows the gain.
+// Must be called within kernel_fpu_begin()/kernel_fpu_end(). Might sleep (see lut_resched()).
+INLINE void lut_build_gain(struct accel_lut *lut, const struct accel_params *p, float range, int flat)
+{
+    float step = range / (ACCEL_LUT_SIZE - 1), integral = 0;
+    int i;
+
+    lut->f.sens[0] = sens_curve(p, 0);     //The limit of integral/speed towards 0
+    for(i = 1; i < ACCEL_LUT_SIZE; i++){
+        if(!(i % LUT_BATCH))
+            lut_resched();
+        integral += curve_integral(p, step * (i - 1), step * i);
+        lut->f.sens[i] = integral / (step * i);
+    }
+
+    if(flat){
+        //Beyond the table, the gain stays where it ends. The output speed then is integral + (rate - range) * gain, so the sensitivity is gain + k/rate.
+        lut->f.end = sens_curve(p, range);
+        lut->f.k = integral - range * lut->f.end;
+        lut->f.tail = 0;
+    } else {
+        //Average slope over another table width, as for a sensitivity curve
+        for(i = 1; i < ACCEL_LUT_SIZE; i++){
+            if(!(i % LUT_BATCH))
+                lut_resched();
+            integral += curve_integral(p, range + step * (i - 1), range + step * i);
+        }
+        lut->f.end = lut->f.sens[ACCEL_LUT_SIZE - 1];
+        lut->f.tail = (integral / (2.0f * range) - lut->f.end) / (ACCEL_LUT_SIZE - 1);
+    }
+}
+
+// Fills the table with the curve of the snapshot p: The float table and its fixed-point twin, so either engine finds its table, whichever is in use.
+// Must be called within kernel_fpu_begin()/kernel_fpu_end(). Might sleep (see lut_resched()).
+INLINE void lut_build(struct accel_lut *lut, const struct accel_params *p)
+{
+    float range, step, tmp;
+    int i, flat;
+
+    range = lut_range(p, &flat);
+    step = range / (ACCEL_LUT_SIZE - 1);
+    lut->f.k = 0;
+
+    if(p->Gain){
+        lut_build_gain(lut, p, range, flat);
+    } else {
+        for(i = 0; i < ACCEL_LUT_SIZE; i++){
+            if(i && !(i % LUT_BATCH))
+                lut_resched();
+            lut->f.sens[i] = sens_curve(p, step * i);
+        }
+        lut->f.end = lut->f.sens[ACCEL_LUT_SIZE - 1];
+        if(flat){
+            //Beyond the table, the curve stays (close to) where it ends
+            lut->f.tail = 0;
+        } else {
+            //Average slope over another table width. Avoids blowing up rounding errors, when extrapolating far beyond the table.
+            lut->f.tail = (sens_curve(p, 2.0f * range) - lut->f.end) / (ACCEL_LUT_SIZE - 1);
+        }
+    }
+    lut->f.inv_step = 1.0f / step;
+
+    for(i = 0; i < ACCEL_LUT_SIZE; i++)
+        lut->fp.sens[i] = Leet_to_fixed(&lut->f.sens[i]);
+    lut->fp.inv_step = (s64) (lut->f.inv_step * (float) FP_ONE);
+    lut->fp.range = (s64) (range * (float) FP_ONE);
+    lut->fp.end = Leet_to_fixed(&lut->f.end);
+    tmp = lut->f.tail * lut->f.inv_step;
+    lut->fp.slope = Leet_to_fixed(&tmp);
+    //k/rate is divided as (k << 16) / rate. Bounding k keeps that within 64 bits.
+    tmp = lut->f.k;
+    if(tmp > 1e9f) tmp = 1e9f;
+    if(tmp < -1e9f) tmp = -1e9f;
+    lut->fp.k = (s64) (tmp * (float) FP_ONE);
+}
+
+// Interpolated sensitivity at the given rate (offset already subtracted)
+INLINE float lut_lookup(const struct accel_lut *lut, float rate)
+{
+    float pos, sens;
+    int i;
+
+    if(rate <= 0)
+        return lut->f.sens[0];
+    pos = rate * lut->f.inv_step;
+    if(pos >= ACCEL_LUT_SIZE - 1){
+        sens = lut->f.end + (pos - (ACCEL_LUT_SIZE - 1)) * lut->f.tail;
+        //Only the tables of a gain have a k. The divide is only ever taken beyond the table.
+        if(lut->f.k != 0)
+            sens += lut->f.k / rate;
+        return sens;
+    }
+    i = (int) pos;
+    return lut->f.sens[i] + (pos - i) * (lut->f.sens[i + 1] - lut->f.sens[i]);
+}
+
+// Same as above in fixed-point.
+// The rate is checked against the range of the table first: rate * inv_step overflows 64 bits for large rates, once the table is fine (down to LUT_MIN_RANGE).
+// Beyond the table, the speed beyond its range is bounded to S32_MAX (32768 counts/ms), so slope * that stays within 64 bits as well.
+INLINE fixedpt lut_lookup_fixed(const struct accel_lut *lut, fixedpt rate)
+{
+    fixedpt pos, sens;
+    int i;
+
+    if(rate <= 0)
+        return lut->fp.sens[0];
+    if(rate >= lut->fp.range){
+        sens = lut->fp.end + fp_mul(min_t(fixedpt, rate - lut->fp.range, S32_MAX), lut->fp.slope);
+        if(lut->fp.k != 0)
+            sens += div64_s64(lut->fp.k * FP_ONE, rate);
+        return sens;
+    }
+    pos = fp_mul(rate, lut->fp.inv_step);
+    i = pos >> FP_SHIFT;
+    //Rounding might put a rate just below the range onto the last entry
+    if(i >= ACCEL_LUT_SIZE - 1)
+        return lut->fp.end;
+    return lut->fp.sens[i] + fp_mul(pos & (FP_ONE - 1), lut->fp.sens[i + 1] - lut->fp.sens[i]);
+}
+
+// Rebuilds the inactive table from the current parameters and then makes it the active one. Runs in process context, never within the completion handler.
+static void lut_update(struct accel_state *state)
+{
+    const struct accel_params *p;
+    int next = !state->lut_active;
+
+    //The rebuild might sleep in between, so an RCU read-side section cannot keep the snapshot alive. Holding the writers' lock does: Nobody can replace (and free) it meanwhile.
+    mutex_lock(&g_params_lock);
+    p = rcu_dereference_protected(g_params, lockdep_is_held(&g_params_lock));
+    //Even the fixed-point engine gets its table from the float curves. We are in process context here, so the FPU is always usable.
+    kernel_fpu_begin();
+    lut_build(&state->lut[next], p);
+    if(p->axis_y != p)
+        lut_build(&state->lut_y[next], p->axis_y);
+    kernel_fpu_end();
+    state->lut_has_y[next] = p->axis_y != p;
+    state->lut_gen = p->gen;
+    mutex_unlock(&g_params_lock);
+
+    //Publish the table only after it has been completely written
+    smp_store_release(&state->lut_active, next);
+}
+
+static void lut_work_fn(struct work_struct *work)
+{
+    struct accel_state *state = container_of(work, struct accel_state, lut_work);
+    bool stale;
+
+    //Packets, which arrived during a rebuild, queued the work once more. Their rebuild is done already, unless the parameters changed meanwhile.
+    rcu_read_lock();
+    stale = state->lut_gen != rcu_dereference(g_params)->gen;
+    rcu_read_unlock();
+    if(!stale)
+        return;
+
+    //The inactive table might have been the active one until the last rebuild. The completion handler reads it within an RCU read-side section, so wait until nobody does anymore.
+    synchronize_rcu();
+    lut_update(state);
+}
+
+// Hands the rebuild of an outdated table over to the workqueue. Until it finished, the completion handler keeps on using the previous table.
+// Returns the index of the active tables.
+INLINE int lut_get(struct accel_state *state, const struct accel_params *p)
+{
+    if(unlikely(state->lut_gen != p->gen))
+        schedule_work(&state->lut_work);
+    return smp_load_acquire(&state->lut_active);
+}
+
+// Sets up the acceleration state of a newly bound device, which is polled every interval_us. Must be called from process context.
+void accel_init(struct accel_state *state, unsigned int interval_us)
+{
+    if(!interval_us) interval_us = USEC_PER_MSEC;
+    state->interval_ns = min_t(s64, interval_us * NSEC_PER_USEC, FRAMETIME_MAX_NS);
+    state->frametime_ns = state->interval_ns;
+
+    INIT_WORK(&state->lut_work, lut_work_fn);
+    lut_update(state);
+}
+
+// Tears down the acceleration state. The device must not deliver any packets anymore.
+void accel_release(struct accel_state *state)
+{
+    cancel_work_sync(&state->lut_work);
 }
 
 // ########## Acceleration code
 
-// Acceleration happens here
-int accelerate(int *x, int *y, int *wheel)
-{
-	float delta_x, delta_y, delta_whl, ms, rate, accel_sens;
-    static long buffer_x = 0;
-    static long buffer_y = 0;
-    static long buffer_whl = 0;
-    //Static float assignment should happen at compile-time and thus should be safe here. However, avoid non-static assignment of floats outside kernel_fpu_begin()/kernel_fpu_end()
-	static float carry_x = 0.0f;
-    static float carry_y = 0.0f;
-    static float carry_whl = 0.0f;
-	static float last_ms = 1.0f;
-	static ktime_t last;
+// Acceleration happens here (floating point engine)
+static int accelerate_float(struct accel_state *state, const struct accel_params *p, const struct accel_lut *lut, const struct accel_lut *lut_y, int *x, int *y, int *wheel)
+{
+	float delta_x, delta_y, delta_whl, ms, rate, accel_sens, accel_sens_y, tmp;
 	ktime_t now;
     int status = 0;
 
     // We can only safely use the FPU in an IRQ event when this returns 1.
     // Not taking care for this interfered with BTRFS on my machine (which also uses kernel_fpu_begin/kernel_fpu_end) and lead to data corruption. And I guess, the same would be true for raid6 (both use kernel_fpu_begin/kernel_fpu_end).
-    if(!irq_fpu_usable()){
-        // Buffer mouse deltas for next (valid) IRQ
-        buffer_x += *x;
-        buffer_y += *y;
-        buffer_whl += *wheel;
+    // accelerate() hands the packet over to the fixed-point engine then
+    if(!irq_fpu_usable())
         return -EBUSY;
-    }
 
 //We are going to use the FPU within the kernel. So we need to safely switch context during all FPU processing in order to not corrupt the userspace FPU state
 //Note: Avoid any function calls (https://yarchive.net/comp/linux/kernel_fp.html - Torvalds: "It all has to be stuff that gcc can do in-line,without any function calls.")
 //This is why we use the "INLINE" pre-processor directive (defined in util.h), which expands to "__attribute__((always_inline)) inline" in order to force gcc to inline the functions defined in float.h
 //Not doing this caused the FPU state to get randomly screwed up (https://github.com/systemofapwne/leetmouse/issues/4), making the cursor to get stuck on the left screen. Especially when playing certain videos in the browser.
 kernel_fpu_begin();
-    accel_sens = g_Sensitivity;
-
     delta_x = (float) (*x);
     delta_y = (float) (*y);
     delta_whl = (float) (*wheel);
@@ -130,9 +1026,9 @@ kernel_fpu_begin();
     // Here we check, if casting did work out.
     if(!((int) delta_x == *x && (int) delta_y == *y && (int) delta_whl == *wheel)){
         // Buffer mouse deltas for next (valid) IRQ
-        buffer_x += *x;
-        buffer_y += *y;
-        buffer_whl += *wheel;
+        state->buffer_x += *x;
+        state->buffer_y += *y;
+        state->buffer_whl += *wheel;
         // Jump out of kernel_fpu_begin
         status = -EFAULT;
         printk("LEETMOUSE: First float-trap triggered. Should very very rarely happen, if at all");
@@ -140,73 +1036,78 @@ kernel_fpu_begin();
     }
 
     //Add buffer values, if present, and reset buffer
-    delta_x += (float) buffer_x; buffer_x = 0;
-    delta_y += (float) buffer_y; buffer_y = 0;
-    delta_whl += (float) buffer_whl; buffer_whl = 0;
+    delta_x += (float) state->buffer_x; state->buffer_x = 0;
+    delta_y += (float) state->buffer_y; state->buffer_y = 0;
+    delta_whl += (float) state->buffer_whl; state->buffer_whl = 0;
 
     //Calculate frametime
     now = ktime_get();
-    ms = (now - last)/(1000*1000);
-    last = now;
-    if(ms < 1) ms = last_ms;    //Sometimes, urbs appear bunched -> Beyond µs resolution so the timing reading is plain wrong. Fallback to last known valid frametime
-    if(ms > 100) ms = 100;      //Original InterAccel has 200 here. RawAccel rounds to 100. So do we.
-    last_ms = ms;
-
-    //Update acceleration parameters periodically
-    updata_params(now);
+    ms = (float) frametime_ns(state, now) / 1000000.0f;
 
     //Prescale
-    delta_x *= g_PreScaleX;
-    delta_y *= g_PreScaleY;
+    delta_x *= p->PreScaleX;
+    delta_y *= p->PreScaleY;
+
+    //Rotate and snap onto the axes. Matrix and threshold come with the parameters.
+    if(p->Rotate){
+        tmp = delta_x * p->RotCos - delta_y * p->RotSin;
+        delta_y = delta_x * p->RotSin + delta_y * p->RotCos;
+        delta_x = tmp;
+    }
+    if(p->SnapTan != 0){
+        if(Leet_abs(&delta_y) <= Leet_abs(&delta_x) * p->SnapTan)
+            delta_y = 0;
+        else if(Leet_abs(&delta_x) <= Leet_abs(&delta_y) * p->SnapTan)
+            delta_x = 0;
+    }
 
     //Calculate velocity (one step before rate, which divides rate by the last frametime)
-    rate = delta_x * delta_x + delta_y * delta_y;
-    B_sqrt(&rate);
+    rate = Leet_hypot(&delta_x, &delta_y);
 
     //Apply speedcap
-    if(g_SpeedCap != 0){
-        if (rate >= g_SpeedCap) {
-            delta_x *= g_SpeedCap / rate;
-            delta_y *= g_SpeedCap / rate;
-            rate = g_SpeedCap;
+    if(p->SpeedCap != 0){
+        if (rate >= p->SpeedCap) {
+            delta_x *= p->SpeedCap / rate;
+            delta_y *= p->SpeedCap / rate;
+            rate = p->SpeedCap;
         }
     }
 
     //Calculate rate from travelled overall distance and add possible rate offsets
     rate /= ms;
-    rate -= g_Offset;
+    state->speed = Leet_to_fixed(&rate);
+    rate -= p->Offset;
 
-    //TODO: Add different acceleration styles
-    //Apply linear acceleration on the sensitivity if applicable and limit maximum value
-    if(rate > 0){
-        rate *= g_Acceleration;
-        accel_sens += rate;
-    }
-    if(g_SensitivityCap > 0 && accel_sens >= g_SensitivityCap){
-        accel_sens = g_SensitivityCap;
+    //Look up the accelerated sensitivity (relative to the base sensitivity) for this rate. By component, each axis gets the one at its own speed instead.
+    if(p->ByComponent){
+        accel_sens = lut_lookup(lut, Leet_abs(&delta_x) / ms - p->Offset);
+        accel_sens_y = lut_lookup(lut_y, Leet_abs(&delta_y) / ms - p->axis_y->Offset);
+    } else {
+        accel_sens = lut_lookup(lut, rate);
+        accel_sens_y = accel_sens;
     }
+    state->sens = Leet_to_fixed(&accel_sens);
 
     //Actually apply accelerated sensitivity, allow post-scaling and apply carry from previous round
-    accel_sens /= g_Sensitivity;
     delta_x *= accel_sens;
-    delta_y *= accel_sens;
-    delta_x *= g_PostScaleX;
-    delta_y *= g_PostScaleY;
-    delta_whl *= g_ScrollsPerTick/3.0f;
-    delta_x += carry_x;
-    delta_y += carry_y;
-    if((delta_whl < 0 && carry_whl < 0) || (delta_whl > 0 && carry_whl > 0)) //Only apply carry to the wheel, if it shares the same sign
-        delta_whl += carry_whl;
+    delta_y *= accel_sens_y;
+    delta_x *= p->PostScaleX;
+    delta_y *= p->PostScaleY;
+    delta_whl *= p->ScrollsPerTick/3.0f;
+    delta_x += state->carry_x;
+    delta_y += state->carry_y;
+    if((delta_whl < 0 && state->carry_whl < 0) || (delta_whl > 0 && state->carry_whl > 0)) //Only apply carry to the wheel, if it shares the same sign
+        delta_whl += state->carry_whl;
 
     //Last check for validity
     if(!(isfinite(&delta_x) && isfinite(&delta_y) && isfinite(&delta_whl))){
         // Buffer mouse deltas for next (valid) IRQ
-        buffer_x += *x;
-        buffer_y += *y;
-        buffer_whl += *wheel;
+        state->buffer_x += *x;
+        state->buffer_y += *y;
+        state->buffer_whl += *wheel;
         // Jump out of kernel_fpu_begin
         printk("LEETMOUSE: Acceleration of NaN value");
-        status = -EFAULT;
+        status = -EDOM;
         goto exit;
     }
 
@@ -224,9 +1125,9 @@ kernel_fpu_begin();
     }
 
     //Save carry for next round
-    carry_x = delta_x - *x;
-    carry_y = delta_y - *y;
-    carry_whl = delta_whl - *wheel;
+    state->carry_x = delta_x - *x;
+    state->carry_y = delta_y - *y;
+    state->carry_whl = delta_whl - *wheel;
     
 exit:
 //We stopped using the FPU: Switch back context again
@@ -234,3 +1135,136 @@ kernel_fpu_end();
 
     return status;
 }
+
+// Acceleration happens here (fixed-point engine)
+// This is the same algorithm as accelerate_float(), but in Q16.16 integer arithmetic. It never uses the FPU, so it neither needs to save/restore the FPU state
+// nor can it run into the FPU being unusable in IRQ context (-EBUSY) or screwed up FPU states (float traps).
+// It reads the fixed-point twin of the table, which is always built along with the float one. So it also handles the packets the floating point engine could not.
+static int accelerate_fixed(struct accel_state *state, const struct accel_params *p, const struct accel_lut *lut, const struct accel_lut *lut_y, int *x, int *y, int *wheel)
+{
+    fixedpt delta_x, delta_y, delta_whl, rate, accel_sens, accel_sens_y, tmp;
+    ktime_t now;
+    s64 ns;
+
+    //Add buffer values (only ever filled by the float traps of the floating point engine), if present, and reset buffer
+    delta_x = FP_FROM_INT(*x + state->buffer_x); state->buffer_x = 0;
+    delta_y = FP_FROM_INT(*y + state->buffer_y); state->buffer_y = 0;
+    delta_whl = FP_FROM_INT(*wheel + state->buffer_whl); state->buffer_whl = 0;
+
+    //Calculate frametime
+    now = ktime_get();
+    ns = frametime_ns(state, now);
+
+    //Prescale
+    delta_x = fp_mul(delta_x, p->fp_PreScaleX);
+    delta_y = fp_mul(delta_y, p->fp_PreScaleY);
+
+    //Rotate and snap onto the axes
+    if(p->Rotate){
+        tmp = fp_mul(delta_x, p->fp_RotCos) - fp_mul(delta_y, p->fp_RotSin);
+        delta_y = fp_mul(delta_x, p->fp_RotSin) + fp_mul(delta_y, p->fp_RotCos);
+        delta_x = tmp;
+    }
+    if(p->fp_SnapTan != 0){
+        if(fp_abs(delta_y) <= fp_mul(fp_abs(delta_x), p->fp_SnapTan))
+            delta_y = 0;
+        else if(fp_abs(delta_x) <= fp_mul(fp_abs(delta_y), p->fp_SnapTan))
+            delta_x = 0;
+    }
+
+    //Calculate velocity (one step before rate, which divides rate by the last frametime)
+    rate = fp_hypot(delta_x, delta_y);
+
+    //Apply speedcap
+    if(p->fp_SpeedCap != 0){
+        if (rate >= p->fp_SpeedCap) {
+            delta_x = div64_s64(delta_x * p->fp_SpeedCap, rate);
+            delta_y = div64_s64(delta_y * p->fp_SpeedCap, rate);
+            rate = p->fp_SpeedCap;
+        }
+    }
+
+    //Calculate rate from travelled overall distance and add possible rate offsets
+    rate = div64_s64(rate * NSEC_PER_MSEC, ns);
+    state->speed = clamp_t(s64, rate, S32_MIN, S32_MAX);
+    rate -= p->fp_Offset;
+
+    //Look up the accelerated sensitivity (relative to the base sensitivity) for this rate. By component, each axis gets the one at its own speed instead.
+    if(p->ByComponent){
+        accel_sens = lut_lookup_fixed(lut, div64_s64(fp_abs(delta_x) * NSEC_PER_MSEC, ns) - p->fp_Offset);
+        accel_sens_y = lut_lookup_fixed(lut_y, div64_s64(fp_abs(delta_y) * NSEC_PER_MSEC, ns) - p->axis_y->fp_Offset);
+    } else {
+        accel_sens = lut_lookup_fixed(lut, rate);
+        accel_sens_y = accel_sens;
+    }
+    state->sens = clamp_t(s64, accel_sens, S32_MIN, S32_MAX);
+
+    //Actually apply accelerated sensitivity, allow post-scaling and apply carry from previous round
+    delta_x = fp_mul(delta_x, accel_sens);
+    delta_y = fp_mul(delta_y, accel_sens_y);
+    delta_x = fp_mul(delta_x, p->fp_PostScaleX);
+    delta_y = fp_mul(delta_y, p->fp_PostScaleY);
+    delta_whl = div_s64(fp_mul(delta_whl, p->fp_ScrollsPerTick), 3);
+    delta_x += state->carry_fixed_x;
+    delta_y += state->carry_fixed_y;
+    if((delta_whl < 0 && state->carry_fixed_whl < 0) || (delta_whl > 0 && state->carry_fixed_whl > 0)) //Only apply carry to the wheel, if it shares the same sign
+        delta_whl += state->carry_fixed_whl;
+
+    //Cast back to int
+    *x = fp_round(delta_x);
+    *y = fp_round(delta_y);
+    *wheel = fp_round(delta_whl);
+
+    //Save carry for next round
+    state->carry_fixed_x = delta_x - FP_FROM_INT(*x);
+    state->carry_fixed_y = delta_y - FP_FROM_INT(*y);
+    state->carry_fixed_whl = delta_whl - FP_FROM_INT(*wheel);
+
+    return 0;
+}
+
+//Hands back the part of the accelerated motion, the report could not carry (e.g. beyond the logical range of its fields). accelerate() adds it to the next packet.
+//Bounded, so a mouse, which keeps outrunning its report, does not leave a long trail of motion behind, once it stopped.
+#define ACCEL_CLIP_MAX 32767
+void accel_clipped(struct accel_state *state, int x, int y, int wheel)
+{
+    state->clip_x = clamp_t(s64, (s64) state->clip_x + x, -ACCEL_CLIP_MAX, ACCEL_CLIP_MAX);
+    state->clip_y = clamp_t(s64, (s64) state->clip_y + y, -ACCEL_CLIP_MAX, ACCEL_CLIP_MAX);
+    state->clip_whl = clamp_t(s64, (s64) state->clip_whl + wheel, -ACCEL_CLIP_MAX, ACCEL_CLIP_MAX);
+}
+
+int accelerate(struct accel_state *state, int *x, int *y, int *wheel)
+{
+    const struct accel_params *p;
+    const struct accel_lut *lut, *lut_y;
+    int status, active;
+
+    //The parameter snapshot (and the lookup table) stay valid until we leave the RCU read-side section
+    rcu_read_lock();
+    p = rcu_dereference(g_params);
+    //Fetch the lookup table outside of any FPU section, since this might need to schedule its rebuild
+    active = lut_get(state, p);
+    lut = &state->lut[active];
+    //The Y axis only has a table of its own, if it follows a curve of its own. Until that table has been built, it shares the one of the X axis.
+    lut_y = state->lut_has_y[active] ? &state->lut_y[active] : lut;
+    if(g_FixedPoint){
+        status = accelerate_fixed(state, p, lut, lut_y, x, y, wheel);
+    } else {
+        status = accelerate_float(state, p, lut, lut_y, x, y, wheel);
+        //The FPU is unusable right now, e.g. because we interrupted another kernel_fpu_begin() section.
+        //Instead of holding the motion back until the next packet (which might be a long time, if the user stopped moving), process it right away with the integer engine.
+        //It reads the fixed-point twin of the float table. The sub-pixel carry of both engines is kept separately.
+        if(status == -EBUSY && !accelerate_fixed(state, p, lut, lut_y, x, y, wheel))
+            status = ACCEL_FALLBACK;
+    }
+    rcu_read_unlock();
+
+    if(status >= 0 && (state->clip_x | state->clip_y | state->clip_whl)){
+        *x += state->clip_x;
+        *y += state->clip_y;
+        *wheel += state->clip_whl;
+        state->clip_x = state->clip_y = state->clip_whl = 0;
+    }
+
+    return status;
+}
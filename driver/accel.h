@@ -1,6 +1,93 @@
 #ifndef _ACCEL_H
 #define _ACCEL_H
 
-int accelerate(int *x, int *y, int *wheel);
+#include <linux/cache.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+
+//Number of entries in the sensitivity lookup table. 256 entries of 4 bytes each keep one table at 1 kB, so it comfortably stays in L1.
+#define ACCEL_LUT_SIZE 256
+
+//Sensitivity (relative to the base sensitivity) over speed (offset already subtracted), uniformly spaced. Whatever the acceleration mode, the packet path only ever looks up this table.
+//It is held as floats and as fixed-point values: The floating point engine reads the former, the fixed-point engine (and the fallback, when the FPU is unusable) the latter.
+//Beyond the last entry, the sensitivity is end + tail * (entries beyond the last one) + k / speed. k is only set for a gain (see lut_build_gain()), which needs a divide there.
+//The fixed-point table takes the slope per speed instead (slope * (speed beyond the range)), so it never needs the position of speeds beyond the table (see lut_lookup_fixed()).
+struct accel_lut {
+    struct {
+        float sens[ACCEL_LUT_SIZE];
+        float inv_step;             //1/(speed between two entries)
+        float end;
+        float tail;                 //Slope per entry beyond the last entry
+        float k;
+    } f;
+    struct {
+        s32 sens[ACCEL_LUT_SIZE];   //Q16.16
+        s64 inv_step;
+        s64 range;                  //Speed of the last entry
+        s32 end;
+        s32 slope;                  //Slope per speed beyond the last entry
+        s64 k;
+    } fp;
+};
+
+//Custom curve (acceleration mode 6): Points of sensitivity (relative to the base sensitivity, like the table) over speed (counts/ms, offset already subtracted), in ascending order of speed.
+//Userspace writes an array of up to ACCEL_CURVE_MAX of them (native byte order) to /sys/module/leetmouse/curve. Like any other parameter, they apply with the next update.
+//The curve is linearly interpolated between the points and constant beyond them. It is resampled into the (uniformly spaced) lookup table of every device.
+#define ACCEL_CURVE_MAX 256
+struct accel_point {
+    float speed;
+    float sens;
+};
+
+//Per-device acceleration state. Every mouse bound to this driver carries its own buffers, carry and frametime clock, so two devices never corrupt each other's timing.
+//The state is aligned to a full cache line, so completions of different devices running on different cores never bounce a shared line.
+struct accel_state {
+    long buffer_x;
+    long buffer_y;
+    long buffer_whl;
+    float carry_x;
+    float carry_y;
+    float carry_whl;
+    s32 carry_fixed_x;      //Carry of the fixed-point engine (Q16.16)
+    s32 carry_fixed_y;
+    s32 carry_fixed_whl;
+    int clip_x;             //Motion (counts), which did not fit into the last report (see accel_clipped()). Goes out with the next one, whatever engine runs.
+    int clip_y;
+    int clip_whl;
+    s64 interval_ns;        //Polling interval of the endpoint
+    s64 frametime_ns;       //Smoothed estimate of the time between two packets
+    s64 last_ns;            //Last measured time between two packets
+    ktime_t last;
+
+    //Input speed (counts/ms, before the offset) and the sensitivity applied (relative to Sensitivity, to X by component) of the last accelerated packet, both Q16.16.
+    //accelerate() never reads them. They are only kept for observers, like the motion stream (see motion.h).
+    s32 speed;
+    s32 sens;
+
+    //Double-buffered lookup table. The completion handler only reads lut[lut_active], while lut_work rebuilds the other one after a parameter update.
+    int lut_active;
+    unsigned int lut_gen;                //Generation of the parameter snapshot the active table was built from
+    struct work_struct lut_work;
+    struct accel_lut lut[2];
+    //Table of the Y axis, if it follows a curve of its own (ByComponent 2). Double-buffered along with lut.
+    unsigned char lut_has_y[2];
+    struct accel_lut lut_y[2];
+} ____cacheline_aligned;
+
+void accel_setup(void);
+void accel_init(struct accel_state *state, unsigned int interval_us);
+void accel_release(struct accel_state *state);
+void accel_cleanup(void);
+void accel_clipped(struct accel_state *state, int x, int y, int wheel);
+//The custom curve, as written to /sys/module/leetmouse/curve (see curve.c), but not necessarily applied yet
+ssize_t accel_curve_read(char *buf, loff_t off, size_t count);
+ssize_t accel_curve_write(const char *buf, loff_t off, size_t count);
+int curve_init(void);
+void curve_exit(void);
+//Returned by accelerate(), when the FPU was unusable and the packet has been accelerated by the fixed-point engine instead
+#define ACCEL_FALLBACK 1
+
+//Returns 0 (or ACCEL_FALLBACK) on success. On -EFAULT (float trap) and -EDOM (non-finite result), the motion is buffered for the next packet.
+int accelerate(struct accel_state *state, int *x, int *y, int *wheel);
 
 #endif /* _ACCEL_H */
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "capture.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/uaccess.h>
+#include <linux/log2.h>
+
+// ########## Kernel module parameters
+static unsigned int g_capture_size = 65536;
+module_param_named(capture_size, g_capture_size, uint, 0644);
+MODULE_PARM_DESC(capture_size, "Number of records in the capture ring, allocated when a capture file is opened (rounded up to a power of 2).");
+
+#define CAPTURE_MIN_SIZE 64
+#define CAPTURE_MAX_SIZE (1 << 22)
+
+// Single-producer/single-consumer ring. The packet path of the device is the only writer of head, the reader of the capture file the only writer of tail.
+// Both run lock-free: A record is published by the release store of head and handed back by the release store of tail.
+struct capture_ring {
+    u32 head ____cacheline_aligned;     // Next record to write (free running)
+    u32 tail ____cacheline_aligned;     // Next record to read (free running)
+    u32 mask;
+    wait_queue_head_t wait;
+    struct capture *cap;                // Device capturing into this ring. NULL, once the device is gone.
+    struct capture_record rec[];
+};
+
+static struct dentry *g_capture_root;
+static DEFINE_MUTEX(g_capture_lock);    // Serializes attaching rings to devices and detaching them
+
+// Never blocks: If the reader falls behind, the packet is dropped (and shows up as gap in seq)
+void capture_write(struct capture_ring *ring, u32 seq, u64 ts, const unsigned char *data, int len, int fields, int btn, const int *in, int x, int y, int wheel, int status)
+{
+    u32 head = ring->head;
+    struct capture_record *r;
+
+    if(head - smp_load_acquire(&ring->tail) > ring->mask)
+        return;
+
+    r = &ring->rec[head & ring->mask];
+    r->ts = ts;
+    r->seq = seq;
+    r->fields = fields;
+    r->status = status;
+    r->btn = btn;
+    r->x = in[0];
+    r->y = in[1];
+    r->wheel = in[2];
+    r->out_x = x;
+    r->out_y = y;
+    r->out_wheel = wheel;
+    r->len = len;
+    memcpy(r->data, data, min_t(int, len, CAPTURE_DATA));
+    if(len < CAPTURE_DATA)
+        memset(r->data + len, 0, CAPTURE_DATA - len);
+    r->reserved = 0;
+    smp_store_release(&ring->head, head + 1);
+
+    //Waking the reader is only worth it, if it actually sleeps (wq_has_sleeper() pairs with the barrier of the waiting reader)
+    if(wq_has_sleeper(&ring->wait))
+        wake_up_interruptible(&ring->wait);
+}
+
+// Detaches the ring from its device. The device stops writing into the ring, once all readers of cap->ring (RCU) are done.
+static void capture_detach(struct capture_ring *ring)
+{
+    mutex_lock(&g_capture_lock);
+    if(ring->cap){
+        RCU_INIT_POINTER(ring->cap->ring, NULL);
+        WRITE_ONCE(ring->cap, NULL);
+    }
+    mutex_unlock(&g_capture_lock);
+}
+
+// ########## debugfs file
+
+// Only a single reader at a time. It owns the ring, which starts out empty.
+static int capture_open(struct inode *inode, struct file *file)
+{
+    struct capture *cap = inode->i_private;
+    struct capture_ring *ring;
+    u32 size = roundup_pow_of_two(clamp_t(u32, READ_ONCE(g_capture_size), CAPTURE_MIN_SIZE, CAPTURE_MAX_SIZE));
+    int ret;
+
+    ring = vzalloc(struct_size(ring, rec, size));
+    if(!ring)
+        return -ENOMEM;
+    ring->mask = size - 1;
+    init_waitqueue_head(&ring->wait);
+
+    //An open racing with capture_remove() must not attach a ring anymore: cap is gone soon after
+    mutex_lock(&g_capture_lock);
+    if(cap->removed || rcu_access_pointer(cap->ring)){
+        ret = cap->removed ? -ENODEV : -EBUSY;
+        mutex_unlock(&g_capture_lock);
+        vfree(ring);
+        return ret;
+    }
+    ring->cap = cap;
+    rcu_assign_pointer(cap->ring, ring);
+    mutex_unlock(&g_capture_lock);
+
+    file->private_data = ring;
+    return stream_open(inode, file);
+}
+
+// The ring may outlive its device: It belongs to the open file and is only freed, when the file gets closed.
+static int capture_release(struct inode *inode, struct file *file)
+{
+    struct capture_ring *ring = file->private_data;
+
+    capture_detach(ring);
+    synchronize_rcu();      // The packet path might still be writing into the ring
+    vfree(ring);
+    return 0;
+}
+
+// Returns whole records only. Blocks until at least one is available, unless the file has been opened non-blocking.
+// Returns 0 (EOF), once the device is gone and all its records have been read (as far as debugfs still lets us, see capture_remove()).
+static ssize_t capture_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    struct capture_ring *ring = file->private_data;
+    u32 head, tail = ring->tail, n, first;
+    size_t rsize = sizeof(struct capture_record);
+    int ret;
+
+    if(count < rsize)
+        return -EINVAL;
+
+    while((head = smp_load_acquire(&ring->head)) == tail){
+        if(!READ_ONCE(ring->cap))
+            return 0;
+        if(file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(ring->wait, smp_load_acquire(&ring->head) != tail || !READ_ONCE(ring->cap));
+        if(ret)
+            return ret;
+    }
+
+    //Copy in at most two chunks: Up to the end of the ring and from its start
+    n = min_t(u32, head - tail, count / rsize);
+    first = min_t(u32, n, ring->mask + 1 - (tail & ring->mask));
+    if(copy_to_user(buf, &ring->rec[tail & ring->mask], first * rsize))
+        return -EFAULT;
+    if(n > first && copy_to_user(buf + first * rsize, ring->rec, (n - first) * rsize))
+        return -EFAULT;
+
+    smp_store_release(&ring->tail, tail + n);
+    return n * rsize;
+}
+
+static __poll_t capture_poll(struct file *file, poll_table *wait)
+{
+    struct capture_ring *ring = file->private_data;
+
+    poll_wait(file, &ring->wait, wait);
+    if(smp_load_acquire(&ring->head) != ring->tail)
+        return EPOLLIN | EPOLLRDNORM;
+    if(!READ_ONCE(ring->cap))
+        return EPOLLHUP;
+    return 0;
+}
+
+static const struct file_operations capture_fops = {
+    .owner   = THIS_MODULE,
+    .open    = capture_open,
+    .release = capture_release,
+    .read    = capture_read,
+    .poll    = capture_poll,
+};
+
+// ########## Devices
+
+// Creates /sys/kernel/debug/leetmouse/<name>/capture. Capturing is a debugging aid, so failures are silently ignored (as debugfs does).
+void capture_add(struct capture *cap, const char *name)
+{
+    RCU_INIT_POINTER(cap->ring, NULL);
+    cap->removed = false;
+    cap->dir = debugfs_create_dir(name, g_capture_root);
+    debugfs_create_file("capture", 0400, cap->dir, cap, &capture_fops);
+}
+
+// Must be called, after the packet path of the device has been stopped.
+// A running capture ends, before the file is removed. Otherwise the removal would wait for a blocked reader.
+// That reader wakes up with the records still in the ring (or EOF, if there are none). Any read after that fails with -EIO, as debugfs cuts off the files it removed.
+void capture_remove(struct capture *cap)
+{
+    struct capture_ring *ring;
+
+    mutex_lock(&g_capture_lock);
+    cap->removed = true;
+    ring = rcu_dereference_protected(cap->ring, lockdep_is_held(&g_capture_lock));
+    if(ring){
+        RCU_INIT_POINTER(cap->ring, NULL);
+        WRITE_ONCE(ring->cap, NULL);
+        wake_up_interruptible(&ring->wait);     // The ring cannot be freed, while we hold the lock
+    }
+    mutex_unlock(&g_capture_lock);
+
+    debugfs_remove_recursive(cap->dir);
+    cap->dir = NULL;
+}
+
+void capture_init(void)
+{
+    g_capture_root = debugfs_create_dir("leetmouse", NULL);
+}
+
+void capture_exit(void)
+{
+    debugfs_remove_recursive(g_capture_root);
+    g_capture_root = NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <linux/types.h>
+
+// Packet capture. While /sys/kernel/debug/leetmouse/<device>/capture is open, every packet of the device is recorded into a lock-free ring,
+// together with what the driver made of it. Reading the file drains the ring in bulk binary records (struct capture_record).
+// The ring only exists while the file is open, so the packet path pays a single pointer check otherwise.
+
+#define CAPTURE_DATA 32     // Bytes of the raw report kept per record
+
+// One record per packet. The layout is fixed, so userspace can read the records as is (see debug/host/capture_dump.c).
+struct capture_record {
+    __u64 ts;               // Time in ns (CLOCK_MONOTONIC), when the driver was done with the packet
+    __u32 seq;              // Packet number. Gaps tell, how many records have been dropped, since the ring was full.
+    __s16 fields;           // Return value of extract_mouse_events()
+    __s16 status;           // Return value of accelerate(). 0, if the packet carried no motion. The error of extract_mouse_events(), if it failed.
+    __s32 btn;
+    __s32 x, y, wheel;      // Decoded from the report
+    __s32 out_x, out_y, out_wheel;  // After acceleration
+    __u16 len;              // Length of the raw report. Only the first CAPTURE_DATA bytes are kept.
+    __u8 data[CAPTURE_DATA];
+    __u16 reserved;
+};
+
+#ifdef __KERNEL__
+
+#include "util.h"
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+
+struct capture_ring;
+
+// Per-device capture state
+struct capture {
+    struct capture_ring __rcu *ring;    // Set while the capture file is open
+    struct dentry *dir;
+    bool removed;                       // Set by capture_remove(). No more rings get attached then.
+    u32 seq;
+};
+
+void capture_write(struct capture_ring *ring, u32 seq, u64 ts, const unsigned char *data, int len, int fields, int btn, const int *in, int x, int y, int wheel, int status);
+
+// Records a packet, if a capture is running. Must be called from the packet path of the device (which never runs concurrently with itself).
+// in holds the decoded x, y and wheel, while x, y and wheel are the values after acceleration.
+static INLINE void capture_packet(struct capture *cap, const unsigned char *data, int len, int fields, int btn, const int *in, int x, int y, int wheel, int status)
+{
+    struct capture_ring *ring;
+    u32 seq = cap->seq++;
+
+    rcu_read_lock();
+    ring = rcu_dereference(cap->ring);
+    if(unlikely(ring))
+        capture_write(ring, seq, ktime_get_ns(), data, len, fields, btn, in, x, y, wheel, status);
+    rcu_read_unlock();
+}
+
+void capture_init(void);
+void capture_exit(void);
+void capture_add(struct capture *cap, const char *name);
+void capture_remove(struct capture *cap);
+
+#endif  //__KERNEL__
+
+#endif  //_CAPTURE_H
@@ -1,11 +1,18 @@
-// Maximum number of packets allowed to be sent from the mouse at once. Linux's default value is 8, which at
-// least causes EOVERFLOW for my mouse (SteelSeries Rival 600). Increase this, if 'dmesg -w' tells you to!
-#define BUFFER_SIZE 16
+// Acceleration engine. 0: Floating point (uses the FPU within the kernel for every packet), 1: Fixed-point (integer only on the packet path)
+// Only the packet path avoids the FPU with 1: Parsing the parameters and building the lookup table of the curve still use it (within kernel_fpu_begin()/kernel_fpu_end(),
+// in process context), on every update and whenever a mouse gets bound. The table is built from the float curves for both engines.
+// Can also be changed when loading the module via the "FixedPoint" parameter
+#define FIXED_POINT 0
+
+// Number of URBs (USB transfers) kept in flight per mouse (1-4). With more than one, the host controller can already poll the mouse again, while the driver is still processing the last packet.
+// Can also be changed when loading the module via the "urbs" parameter
+#define NUM_URBS 2
 
 /*
  * This should be your desired acceleration. It needs to end with an f.
  * For example, setting this to "0.1f" should be equal to
  * cl_mouseaccel 0.1 in Quake.
+ * The whole part of any of the values below may not exceed 32768 (fixed-point range). Larger values are rejected with -ERANGE.
  */
 
 // Changes behaviour of the scroll-wheel. Default is 3.0f
@@ -20,6 +27,42 @@
 #define POST_SCALE_Y 0.4f
 #define SPEED_CAP 0.0f
 
+// Shape of the sensitivity curve. All modes are equally fast on the packet path, since the curve is only ever looked up from a table.
+// 0: Linear       Sensitivity + Acceleration * speed, up to SENS_CAP (0: no cap)
+// 1: Classic      Sensitivity + (Acceleration * speed)^(EXPONENT - 1), up to SENS_CAP (0: no cap)
+// 2: Power        Sensitivity * (1 + Acceleration * speed)^EXPONENT, up to SENS_CAP (0: no cap)
+// 3: Natural      Rises from Sensitivity and smoothly approaches SENS_CAP. Acceleration sets how fast.
+// 4: Jump         Steps from Sensitivity to SENS_CAP at MIDPOINT. Acceleration > 0 smoothens the step (the larger, the sharper).
+// 5: Synchronous  Sensitivity at MIDPOINT. Approaches SENS_CAP for fast motion and Sensitivity^2/SENS_CAP for slow motion. Acceleration sets how fast.
+// 6: Custom       Points written to /sys/module/leetmouse/curve (see README.org). Until they have been written, the motion is not accelerated.
+// Beyond its lookup table, a curve without a cap (SENS_CAP 0) is continued as a straight line. So without a cap, only curves ending in a straight line are accepted:
+// Linear, classic with an EXPONENT of 2 (or 1) and power with an EXPONENT of 1 (or 0). Any other classic or power curve needs a SENS_CAP. An update with such parameters fails with -EINVAL.
+// Can also be changed when loading the module via the "AccelMode", "Exponent" and "Midpoint" parameters
+#define ACCEL_MODE 0
+#define EXPONENT 2.0f
+#define MIDPOINT 5.0f
+
+// 1: The curve above is the gain (how much faster the cursor gets, as the mouse gets faster) instead of the sensitivity. The cursor speed then follows the curve's integral,
+// so it never jumps, where the curve has a kink (e.g. at SENS_CAP) or a step (jump mode). Costs nothing per packet: The integral is taken, when the parameters change.
+// Can also be changed when loading the module via the "Gain" parameter
+#define GAIN 0
+
+// 1: Accelerate X and Y separately, each by the sensitivity at its own speed (by component). Combine with POST_SCALE_X/Y for different sensitivities per axis.
+// 2: Same, but the Y axis follows a curve of its own: Same mode and Sensitivity, but the *_Y values below instead of ACCELERATION, SENS_CAP, OFFSET, EXPONENT and MIDPOINT.
+// Can also be changed when loading the module via the "ByComponent", "AccelerationY", "SensitivityCapY", "OffsetY", "ExponentY" and "MidpointY" parameters. Other values are rejected.
+#define BY_COMPONENT 0
+#define ACCELERATION_Y 0.26f
+#define SENS_CAP_Y 4.0f
+#define OFFSET_Y 0.0f
+#define EXPONENT_Y 2.0f
+#define MIDPOINT_Y 5.0f
+
+// Rotate the motion by this angle in degrees (clockwise on screen, -360 to 360), e.g. for a sensor mounted at an angle. Applied after the prescaler.
+// Motion within ANGLE_SNAPPING degrees (0 to below 45) of the horizontal or vertical axis snaps onto it. 0 disables either.
+// Can also be changed when loading the module via the "AngleAdjustment" and "AngleSnapping" parameters
+#define ANGLE_ADJUSTMENT 0.0f
+#define ANGLE_SNAPPING 0.0f
+
 // Prescaler for different DPI values. 1.0f at 400 DPI. To adjust it for <your_DPI>, calculate 400/your_DPI
 
 // Generic @ 400 DPI
@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "accel.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/sysfs.h>
+#include <linux/version.h>
+
+// /sys/module/leetmouse/curve: The points of the custom curve (acceleration mode 6) as binary array of struct accel_point (see accel.h).
+// Writing only stages them. Like the string parameters, they are checked and applied, once /sys/module/leetmouse/parameters/update is written to.
+// The bin_attribute callbacks took a const attribute with 6.13 (as read_new/write_new until they replaced read/write with 6.17)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+#define CURVE_ATTR const struct bin_attribute
+#else
+#define CURVE_ATTR struct bin_attribute
+#endif
+
+static ssize_t curve_read(struct file *file, struct kobject *kobj, CURVE_ATTR *attr, char *buf, loff_t off, size_t count)
+{
+    return accel_curve_read(buf, off, count);
+}
+
+static ssize_t curve_write(struct file *file, struct kobject *kobj, CURVE_ATTR *attr, char *buf, loff_t off, size_t count)
+{
+    return accel_curve_write(buf, off, count);
+}
+
+static struct bin_attribute curve_attr = {
+    .attr = { .name = "curve", .mode = 0644 },
+    .size = ACCEL_CURVE_MAX * sizeof(struct accel_point),
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0) && LINUX_VERSION_CODE < KERNEL_VERSION(6,17,0)
+    .read_new = curve_read,
+    .write_new = curve_write,
+#else
+    .read = curve_read,
+    .write = curve_write,
+#endif
+};
+
+int curve_init(void)
+{
+    return sysfs_create_bin_file(&THIS_MODULE->mkobj.kobj, &curve_attr);
+}
+
+void curve_exit(void)
+{
+    sysfs_remove_bin_file(&THIS_MODULE->mkobj.kobj, &curve_attr);
+}
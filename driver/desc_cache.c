@@ -0,0 +1,219 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "desc_cache.h"
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/crc32.h>
+#include <linux/ctype.h>
+#include <linux/hid.h>
+#include <linux/module.h>
+
+struct desc_cache_entry {
+    struct list_head list;
+    struct desc_cache_key key;
+    u32 crc;
+    struct report_positions pos;
+    unsigned char desc[];           // The raw report descriptor (key.len bytes)
+};
+
+static LIST_HEAD(g_desc_cache);     // Most recently used entry first
+static unsigned int g_desc_cache_len = 0;
+static DEFINE_MUTEX(g_desc_cache_lock);
+
+INLINE int key_equal(const struct desc_cache_key *a, const struct desc_cache_key *b)
+{
+    return a->vendor == b->vendor && a->product == b->product && a->bcd_device == b->bcd_device && a->ifnum == b->ifnum && a->len == b->len;
+}
+
+static struct desc_cache_entry *find_locked(const struct desc_cache_key *key)
+{
+    struct desc_cache_entry *e;
+
+    list_for_each_entry(e, &g_desc_cache, list){
+        if(key_equal(&e->key, key))
+            return e;
+    }
+    return NULL;
+}
+
+// Looks up the layout for the given key. Returns 1 and fills pos on a hit, without the descriptor having to be read from the device.
+// The entry is checked against its own CRC32 first: A damaged entry is dropped and reported as a miss, so the caller reads and parses the descriptor again.
+int desc_cache_get(const struct desc_cache_key *key, struct report_positions *pos)
+{
+    struct desc_cache_entry *e;
+
+    mutex_lock(&g_desc_cache_lock);
+    e = find_locked(key);
+    if(e && crc32_le(~0, e->desc, key->len) != e->crc){
+        list_del(&e->list);
+        g_desc_cache_len--;
+        kfree(e);
+        e = NULL;
+    }
+    if(e){
+        memcpy(pos, &e->pos, sizeof(struct report_positions));
+        list_move(&e->list, &g_desc_cache);
+    }
+    mutex_unlock(&g_desc_cache_lock);
+
+    return e != NULL;
+}
+
+// Inserts (or replaces) the entry for an entirely read report descriptor and its parsed layout
+static void insert(struct desc_cache_entry *n)
+{
+    struct desc_cache_entry *e;
+
+    mutex_lock(&g_desc_cache_lock);
+    e = find_locked(&n->key);
+    if(e){
+        list_del(&e->list);
+        kfree(e);
+        g_desc_cache_len--;
+    }
+    list_add(&n->list, &g_desc_cache);
+    if(++g_desc_cache_len > DESC_CACHE_SIZE){
+        e = list_last_entry(&g_desc_cache, struct desc_cache_entry, list);
+        list_del(&e->list);
+        kfree(e);
+        g_desc_cache_len--;
+    }
+    mutex_unlock(&g_desc_cache_lock);
+}
+
+void desc_cache_put(const struct desc_cache_key *key, const unsigned char *desc, const struct report_positions *pos)
+{
+    struct desc_cache_entry *n = kmalloc(sizeof(struct desc_cache_entry) + key->len, GFP_KERNEL);
+
+    // The cache is optional. Without memory, the next probe just reads the descriptor again.
+    if(!n)
+        return;
+    n->key = *key;
+    n->crc = crc32_le(~0, desc, key->len);
+    memcpy(&n->pos, pos, sizeof(struct report_positions));
+    memcpy(n->desc, desc, key->len);
+    insert(n);
+}
+
+void desc_cache_clear(void)
+{
+    struct desc_cache_entry *e, *tmp;
+
+    mutex_lock(&g_desc_cache_lock);
+    list_for_each_entry_safe(e, tmp, &g_desc_cache, list){
+        list_del(&e->list);
+        kfree(e);
+    }
+    g_desc_cache_len = 0;
+    mutex_unlock(&g_desc_cache_lock);
+}
+
+// ########## Dump & preload via /sys/module/leetmouse/parameters/desc_cache
+
+// Parses a single line "vendor:product:bcdDevice:interface crc32 descriptor" and adds it to the cache
+static int preload_line(const char *line, size_t len)
+{
+    struct desc_cache_key key;
+    struct desc_cache_entry *n;
+    unsigned int vendor, product, bcd, ifnum, crc;
+    const char *hex;
+    int ret, consumed = 0, hex_len;
+
+    if(sscanf(line, "%x:%x:%x:%x %x %n", &vendor, &product, &bcd, &ifnum, &crc, &consumed) != 5 || !consumed || consumed > len)
+        return -EINVAL;
+    hex = line + consumed;
+    hex_len = len - consumed;
+    while(hex_len > 0 && isspace(hex[hex_len - 1]))
+        hex_len--;
+    if(hex_len <= 0 || hex_len % 2 || hex_len / 2 > HID_MAX_DESCRIPTOR_SIZE)
+        return -EINVAL;
+
+    key.vendor = vendor;
+    key.product = product;
+    key.bcd_device = bcd;
+    key.ifnum = ifnum;
+    key.len = hex_len / 2;
+
+    n = kmalloc(sizeof(struct desc_cache_entry) + key.len, GFP_KERNEL);
+    if(!n)
+        return -ENOMEM;
+    n->key = key;
+    ret = hex2bin(n->desc, hex, key.len);
+    if(!ret && crc32_le(~0, n->desc, key.len) != crc)
+        ret = -EBADMSG;
+    if(!ret)
+        ret = parse_report_desc(n->desc, key.len, &n->pos) < 0 ? -EINVAL : 0;
+    if(ret){
+        kfree(n);
+        return ret;
+    }
+    n->crc = crc;
+    insert(n);
+
+    return 0;
+}
+
+static int desc_cache_set(const char *val, const struct kernel_param *kp)
+{
+    const char *end;
+    size_t len;
+    int ret;
+
+    if(sysfs_streq(val, "clear")){
+        desc_cache_clear();
+        return 0;
+    }
+
+    while(*val){
+        end = strchrnul(val, '\n');
+        len = end - val;
+        if(len && *val != '#'){
+            ret = preload_line(val, len);
+            if(ret){
+                printk("LEETMOUSE: Invalid descriptor cache entry (%d)", ret);
+                return ret;
+            }
+        }
+        val = *end ? end + 1 : end;
+    }
+
+    return 0;
+}
+
+#define DUMP_TRUNCATED 48   // Room kept for the line, which tells about left out entries
+
+static int desc_cache_dump(char *buffer, const struct kernel_param *kp)
+{
+    struct desc_cache_entry *e;
+    unsigned int dumped = 0, left;
+    int len = 0;
+
+    mutex_lock(&g_desc_cache_lock);
+    list_for_each_entry(e, &g_desc_cache, list){
+        // Entries, which do not fit into the page anymore, are left out. The least recently used ones go first.
+        if(len + 32 + 2 * e->key.len + DUMP_TRUNCATED >= PAGE_SIZE)
+            break;
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "%04x:%04x:%04x:%x %08x ", e->key.vendor, e->key.product, e->key.bcd_device, e->key.ifnum, e->crc);
+        len = bin2hex(buffer + len, e->desc, e->key.len) - buffer;
+        buffer[len++] = '\n';
+        dumped++;
+    }
+    left = g_desc_cache_len - dumped;
+    mutex_unlock(&g_desc_cache_lock);
+
+    // A comment line, so the dump can still be written back as is
+    if(left)
+        len += scnprintf(buffer + len, PAGE_SIZE - len, "# truncated: %u of %u entries left out\n", left, dumped + left);
+
+    return len;
+}
+
+static const struct kernel_param_ops desc_cache_ops = {
+    .set = desc_cache_set,
+    .get = desc_cache_dump,
+};
+module_param_cb(desc_cache, &desc_cache_ops, NULL, 0644);
+MODULE_PARM_DESC(desc_cache, "Parsed report descriptors of known mice. Read to dump, write to preload (one entry per line) or write 'clear'.");
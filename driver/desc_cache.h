@@ -0,0 +1,39 @@
+#ifndef _DESC_CACHE_H
+#define _DESC_CACHE_H
+
+#include "util.h"
+#include <linux/types.h>
+#include <linux/usb.h>
+
+// Module-wide cache of parsed report descriptors. Re-plugging or rebinding a known mouse reuses its layout and does not parse the report descriptor again.
+// Entries are keyed by everything we know about the descriptor before reading it (including its length), so a hit skips reading the descriptor from the device at all.
+// Each entry is checked against the CRC32 of its stored descriptor on a hit. A damaged entry is dropped and the descriptor is read and parsed again.
+// A firmware update, which changed the descriptor but neither its length nor bcdDevice, is not noticed: Write "clear" after such an update.
+// The descriptor itself is kept alongside, so the cache can be dumped and preloaded
+// via /sys/module/leetmouse/parameters/desc_cache (one entry per line: "vendor:product:bcdDevice:interface crc32 descriptor", all hex). Writing "clear" empties the cache.
+// Lines starting with '#' are ignored. A dump, which does not fit into a page, ends with such a line, telling how many entries have been left out.
+
+#define DESC_CACHE_SIZE 16      // Entries kept. The least recently used one is dropped first.
+
+struct desc_cache_key {
+    u16 vendor;
+    u16 product;
+    u16 bcd_device;
+    u8 ifnum;
+    u16 len;            // Length of the report descriptor, as announced by the HID descriptor
+};
+
+static inline void desc_cache_key_init(struct desc_cache_key *key, struct usb_device *dev, u8 ifnum, u16 len)
+{
+    key->vendor = le16_to_cpu(dev->descriptor.idVendor);
+    key->product = le16_to_cpu(dev->descriptor.idProduct);
+    key->bcd_device = le16_to_cpu(dev->descriptor.bcdDevice);
+    key->ifnum = ifnum;
+    key->len = len;
+}
+
+int desc_cache_get(const struct desc_cache_key *key, struct report_positions *pos);
+void desc_cache_put(const struct desc_cache_key *key, const unsigned char *desc, const struct report_positions *pos);
+void desc_cache_clear(void);
+
+#endif  //_DESC_CACHE_H
@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#ifndef _FIXEDPOINT_H
+#define _FIXEDPOINT_H
+
+#include "util.h"
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>   //fls64
+
+// Fixed-point arithmetic. This is the integer-only counterpart to float.h, used by the fixed-point acceleration engine.
+// Nothing in here touches the FPU, so it is safe to use anywhere - no kernel_fpu_begin() / kernel_fpu_end() needed.
+// Numbers are Q16.16 (16 fractional bits). They are carried in a s64 though, which leaves enough headroom for squared sums and products of mouse deltas.
+typedef s64 fixedpt;
+
+#define FP_SHIFT 16
+#define FP_ONE (1ll << FP_SHIFT)
+#define FP_HALF (FP_ONE >> 1)
+//Largest whole part a parameter may have. Products of two parameters (fp_mul) then stay within 64 bits.
+#define FP_MAX_WHOLE (1ll << 15)
+
+//Converts a float constant (e.g. from "config.h") to fixed-point. Only use this on constants, so the compiler folds it and no float arithmetic ends up in the binary.
+#define FP_CONST(f) ((fixedpt) ((f) * (float) FP_ONE + ((f) >= 0 ? 0.5f : -0.5f)))
+#define FP_FROM_INT(i) (((fixedpt) (i)) * FP_ONE)
+
+//Multiplication: a*b
+static INLINE fixedpt fp_mul(fixedpt a, fixedpt b)
+{
+    return (a * b) >> FP_SHIFT;
+}
+
+//Division: a/b
+static INLINE fixedpt fp_div(fixedpt a, fixedpt b)
+{
+    return div64_s64(a * FP_ONE, b);
+}
+
+//Absolute value
+static INLINE fixedpt fp_abs(fixedpt f)
+{
+    return f < 0 ? -f : f;
+}
+
+// Rounds (up/down) depending on sign. Same behaviour as Leet_round() in float.h
+static INLINE int fp_round(fixedpt f)
+{
+    if (f >= 0) {
+        return (int) ((f + FP_HALF) >> FP_SHIFT);
+    } else {
+        return -(int) ((-f + FP_HALF) >> FP_SHIFT);
+    }
+}
+
+//Integer square root: floor(sqrt(n)). Classic digit-by-digit method, which only needs shifts, adds and compares.
+//It starts right at the highest digit of n and decides every digit without a branch: Whether a digit is set, is as good as random, so branches on it would mostly be mispredicted.
+static INLINE u64 isqrt64(u64 n)
+{
+    u64 res = 0, bit, t, set;
+
+    if(!n)
+        return 0;
+    bit = 1ull << ((fls64(n) - 1) & ~1);
+    while(bit){
+        t = res + bit;
+        set = -(u64) (n >= t);          //All ones, if the digit is set
+        n -= t & set;
+        res = (res >> 1) + (bit & set);
+        bit >>= 2;
+    }
+    return res;
+}
+
+//Magnitude of a vector: sqrt(x² + y²). The squares of Q16.16 numbers are Q32.32, so their square root is Q16.16 again.
+static INLINE fixedpt fp_hypot(fixedpt x, fixedpt y)
+{
+    int shift = 0;
+
+    if(x < 0) x = -x;
+    if(y < 0) y = -y;
+    //Keep the squared sum within 64 bits. This only kicks in for deltas beyond 32767 counts, where the lost LSBs do not matter.
+    while((x | y) >= (1ll << 31)){
+        x >>= 1;
+        y >>= 1;
+        shift++;
+    }
+    return (fixedpt) isqrt64((u64) (x*x) + (u64) (y*y)) << shift;
+}
+
+//Converts string to fixed-point. Accepts the same format as atof() in float.h, but never touches the FPU.
+//Returns -ERANGE for whole parts beyond FP_MAX_WHOLE.
+static INLINE int atofp(const char *str, int len, fixedpt *result)
+{
+    s64 whole = 0, frac = 0, scale = 1;
+    signed char sign = 0;
+    int i, is_whole = 1;
+    char c;
+
+    *result = 0;
+
+    for(i = 0; i < len; i++){
+        c = str[i];
+        if(c == ' ') continue;              //Skip any white space
+        if(c == 0 || c == 'f') break;       //End of str or end of valid input
+        if(c == '-'){                       //Sign found
+            if(!sign){
+                sign = -1;
+                continue;
+            } else {
+                //Unexpected sign: We already determined a sign earlier
+                return -EINVAL;
+            }
+        }
+        if(c == '.'){                       //Switch from whole to decimal
+            if(!is_whole) return -EINVAL;
+            is_whole = 0;
+            continue;
+        }
+
+        if(!(c >= '0' && c <= '9')) return -EINVAL;
+        if(!sign) sign = 1;                 //If no sign was yet applied, it has to be positive
+
+        if(is_whole){
+            whole = whole*10 + (c - '0');
+            if(whole > FP_MAX_WHOLE) return -ERANGE;
+        } else if(scale < 1000000000) {     //Digits beyond 1e-9 are way below the resolution of Q16.16 anyway
+            frac = frac*10 + (c - '0');
+            scale *= 10;
+        }
+    }
+    *result = sign * (whole * FP_ONE + div64_s64(frac * FP_ONE + scale/2, scale));
+
+    return 0;
+}
+
+#endif // _FIXEDPOINT_H
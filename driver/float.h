@@ -24,7 +24,7 @@ static INLINE int atof(const char *str, int len, float *result)
     for(i = 0; i < len; i++){
         c = str[i];
         if(c == ' ') continue;              //Skip any white space
-        if(c == 0 && c == 'f') break;       //End of str or end of valid input
+        if(c == 0 || c == 'f') break;       //End of str or end of valid input
         if(c == '-'){                       //Sign found
             if(!sign){
                 sign = -1;
@@ -69,6 +69,22 @@ static INLINE int Leet_round(float *x)
     }
 }
 
+// Absolute value
+static INLINE float Leet_abs(float *x)
+{
+    return *x < 0 ? -*x : *x;
+}
+
+// Converts to Q16.16 (see fixedpoint.h), saturating at the range of a s32. NaN saturates as well.
+static INLINE s32 Leet_to_fixed(float *x)
+{
+    if (!(*x < 32767.0f))
+        return 0x7fffffff;
+    if (*x <= -32768.0f)
+        return -0x7fffffff - 1;
+    return (s32)(*x * 65536.0f);
+}
+
 //Floating point approximate arithmetic as presented in "Jim Blinn's Floating-Point Tricks" paper from 1997
 //You might find it here https://www.yumpu.com/en/document/read/6104114/floating-point-tricks-ieee-computer-graphics-and-applications
 static const unsigned int OneAsInt = 0x3F800000;   //1.0f as int
@@ -125,6 +141,93 @@ static INLINE void B_sqrt(float *f)
     *f = (y*y + *f)/(2*y);                          // 1st iteration
 }
 
+//Magnitude of a vector: sqrt(x² + y²), within 0.031% (B_sqrt above is off by up to 0.17%, depending on the exponent of the squared sum).
+//Same idea as B_sqrt, but with a guess tuned for the largest error after one Newton step. That error is one-sided (Newton always overshoots),
+//so the step is scaled down by half of it, which centers the error around 0. Needs one multiplication less than B_sqrt.
+static INLINE float Leet_hypot(float *x, float *y)
+{
+    float s = *x * *x + *y * *y, r;
+    unsigned int i;
+
+    if(s == 0)
+        return 0;
+    i = (ASINT(&s) >> 1) + 0x1FBB6800;
+    r = ASFLOAT(&i);
+    return (r + s / r) * 0.49984970f;     //0.5 * (1 - 3.006e-4)
+}
+
+//Accurate arithmetic (within a few ULP), as opposed to the approximations above. Still inline and without any call into libm, but slower.
+//Meant for code off the packet path, like building the sensitivity lookup table.
+
+//exp base e: e^f. Splits f into k*ln(2) + r with |r| <= ln(2)/2, so e^f = 2^k * e^r. e^r converges quickly as a Taylor series.
+static INLINE void Leet_exp(float *f)
+{
+    float x = *f, r;
+    unsigned int e;
+    int k;
+
+    if(x < -87.0f){         //Below the smallest normal float
+        *f = 0.0f;
+        return;
+    }
+    if(x > 88.0f)           //Saturate just below the largest float
+        x = 88.0f;
+    k = (int) (x * 1.44269504f + (x >= 0 ? 0.5f : -0.5f));
+    r = (x - k * 0.693145752f) - k * 1.42860677e-6f;    //ln(2) split into two parts, so k*ln(2) loses no precision
+    e = (unsigned int) (k + 127) << 23;                 //2^k
+    *f = (1.0f + r*(1.0f + r*(1.0f/2 + r*(1.0f/6 + r*(1.0f/24 + r*(1.0f/120 + r*(1.0f/720 + r*(1.0f/5040)))))))) * ASFLOAT(&e);
+}
+
+//log base e: ln(f) for f > 0. Splits f into 2^e * m with m in [sqrt(1/2), sqrt(2)), where ln(m) = 2*atanh((m - 1)/(m + 1)) converges quickly.
+static INLINE void Leet_log(float *f)
+{
+    unsigned int i = ASINT(f);
+    int e = (int) (i >> 23) - 127;
+    float m, s, s2;
+
+    i = (i & 0x007fffff) | OneAsInt;
+    m = ASFLOAT(&i);
+    if(m > 1.41421356f){
+        m *= 0.5f;
+        e++;
+    }
+    s = (m - 1.0f) / (m + 1.0f);
+    s2 = s*s;
+    *f = e * 0.693147181f + 2.0f*s*(1.0f + s2*(1.0f/3 + s2*(1.0f/5 + s2*(1.0f/7 + s2*(1.0f/9)))));
+}
+
+//power: f^p for f >= 0
+static INLINE void Leet_pow(float *f, float *p)
+{
+    if(*f <= 0){
+        *f = *p == 0 ? 1.0f : 0.0f;
+        return;
+    }
+    Leet_log(f);
+    *f *= *p;
+    Leet_exp(f);
+}
+
+//sine and cosine of an angle in degrees. Reduces the angle to within 45° of the nearest multiple of 90°, where the Taylor series converge quickly.
+//Only for angles of a sane size (the multiple of 90° has to fit into an int).
+static INLINE void Leet_sincos(float *deg, float *s, float *c)
+{
+    float x = *deg, r, r2, sr, cr;
+    int q;
+
+    q = (int) (x / 90.0f + (x >= 0 ? 0.5f : -0.5f));
+    r = (x - q * 90.0f) * 0.0174532925f;       //In radians, |r| <= pi/4
+    r2 = r*r;
+    sr = r*(1.0f - r2/6*(1.0f - r2/20*(1.0f - r2/42*(1.0f - r2/72))));
+    cr = 1.0f - r2/2*(1.0f - r2/12*(1.0f - r2/30*(1.0f - r2/56)));
+    switch(q & 3){      //Quadrant (also for negative q in two's complement)
+    case 0: *s = sr;  *c = cr;  break;
+    case 1: *s = cr;  *c = -sr; break;
+    case 2: *s = -sr; *c = -cr; break;
+    case 3: *s = -cr; *c = sr;  break;
+    }
+}
+
 //Checks, if a float is a finite number or NaN/Infinity
 static const unsigned int NaNAsInt = 0xFFFFFFFF;   //NaN
 static const unsigned int PInfAsInt = 0x7F800000;  //Positive Infinity
@@ -0,0 +1,511 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Native binding via the HID core. Instead of stealing the USB interface from usbhid, leetmouse sits on top of the existing HID transport (usbhid, Bluetooth, uhid, ...)
+// as a hid_driver. Its raw_event hook accelerates every input report in place, before the HID core parses it. So the mouse comes up already accelerated, as soon as it is plugged in.
+//
+// Only mice of the generic group, which are not claimed by a more specific driver, are taken. Everything else is left to hid-generic.
+// hid-generic backs off from any device our id table matches, without asking our .match. So the table itself must only match mice: It is filled at runtime with the ids
+// of every device, whose report descriptor has a mouse application collection. Other interfaces of such a device share its id, so hid-generic backs off from them as well.
+// The probe rejects them and hands them back to hid-generic by a reprobe. Kernels without HID_QUIRK_IGNORE_SPECIAL_DRIVER cannot do so: There they are bound, but passed through untouched.
+
+#include "hidmouse.h"
+#include "accel.h"
+#include "config.h"
+#include "util.h"
+#include "stats.h"
+#include "capture.h"
+#include "motion.h"
+#include "leetmouse_trace.h"
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/module.h>
+#include <linux/hid.h>
+#include <linux/usb.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+
+// ########## Kernel module parameters
+static char g_hid_bind = 0;
+module_param_named(hid_bind, g_hid_bind, byte, 0444);
+MODULE_PARM_DESC(hid_bind, "Also register as HID driver and accelerate mice right on top of usbhid (or any other HID transport, e.g. /dev/uhid), without rebinding them.");
+
+struct hid_mouse {
+    struct report_positions pos;
+    struct accel_state accel;
+    struct leetmouse_stats stats;
+    struct capture capture;
+    struct motion motion;
+};
+
+static struct hid_driver hid_mouse_driver;
+
+// ########## Matching
+
+// Filled by hid_mouse_learn(). Entries are only ever appended: The HID core reads the table without any lock.
+#define HID_MOUSE_IDS 32
+static struct hid_device_id hid_mouse_id_table[HID_MOUSE_IDS + 1];    // Terminated by an entry with bus 0
+static unsigned int g_hid_mouse_ids = 0;
+static DEFINE_MUTEX(g_hid_mouse_ids_lock);
+
+// Looks for an application collection of a mouse (Generic Desktop / Mouse) in the raw report descriptor.
+// This runs, before the HID core parsed the descriptor. hid_mouse_is_mouse() checks the parsed one.
+static bool hid_mouse_rdesc_is_mouse(const u8 *rdesc, unsigned int size)
+{
+    unsigned int i = 0, n, len, value, page = 0, usage = 0;
+    bool have_usage = false;
+    u8 item;
+
+    while (i < size) {
+        item = rdesc[i];
+        if (item == 0xFE) {                 // Long item: Size of its data follows
+            if (i + 1 >= size)
+                break;
+            i += 3 + rdesc[i + 1];
+            continue;
+        }
+        len = (item & 0x03) == 3 ? 4 : item & 0x03;
+        if (i + 1 + len > size)
+            break;
+        for (value = 0, n = 0; n < len; n++)
+            value |= rdesc[i + 1 + n] << (8 * n);
+
+        switch (item & 0xFC) {
+        case D_USAGE_PAGE:
+            page = value;
+            break;
+        case D_USAGE:
+            // A collection takes the first usage. 4-byte usages carry their own page.
+            if (!have_usage)
+                usage = len == 4 ? value : (page << 16) | value;
+            have_usage = true;
+            break;
+        case D_COLLECTION:
+            if (value == HID_COLLECTION_APPLICATION && usage == HID_GD_MOUSE)
+                return true;
+            fallthrough;
+        case D_END_COLLECTION:
+        case D_INPUT:
+        case D_OUTPUT:
+        case D_FEATURE:
+            // Main items clear the local ones
+            have_usage = false;
+            usage = 0;
+            break;
+        }
+        i += 1 + len;
+    }
+    return false;
+}
+
+// Adds the id of a generic mouse to our table, so hid-generic leaves it to us
+static void hid_mouse_learn(struct hid_device *hdev)
+{
+    struct hid_device_id *id;
+    unsigned int i;
+
+    if (hdev->group != HID_GROUP_GENERIC || !hdev->dev_rdesc || !hid_mouse_rdesc_is_mouse(hdev->dev_rdesc, hdev->dev_rsize))
+        return;
+
+    mutex_lock(&g_hid_mouse_ids_lock);
+    for (i = 0; i < g_hid_mouse_ids; i++) {
+        id = hid_mouse_id_table + i;
+        if (id->bus == hdev->bus && id->vendor == hdev->vendor && id->product == hdev->product)
+            goto out;
+    }
+    if (g_hid_mouse_ids == HID_MOUSE_IDS) {
+        hid_warn(hdev, "too many different mice. Leaving this one to hid-generic.\n");
+        goto out;
+    }
+    id = hid_mouse_id_table + g_hid_mouse_ids++;
+    id->group = HID_GROUP_GENERIC;
+    id->vendor = hdev->vendor;
+    id->product = hdev->product;
+    // Publish the entry with its bus (the terminator until then), once the rest of it is in place
+    smp_wmb();
+    WRITE_ONCE(id->bus, hdev->bus);
+out:
+    mutex_unlock(&g_hid_mouse_ids_lock);
+}
+
+static int hid_mouse_learn_one(struct device *dev, void *data)
+{
+    hid_mouse_learn(to_hid_device(dev));
+    return 0;
+}
+
+// New devices are learned, before the driver core probes any driver for them
+static int hid_mouse_notify(struct notifier_block *nb, unsigned long action, void *data)
+{
+    if (action == BUS_NOTIFY_ADD_DEVICE)
+        hid_mouse_learn(to_hid_device(data));
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block hid_mouse_nb = {
+    .notifier_call = hid_mouse_notify,
+};
+
+static int hid_mouse_check_other(struct device_driver *drv, void *data)
+{
+    struct hid_driver *hdrv = to_hid_driver(drv);
+
+    if (hdrv == &hid_mouse_driver || !strcmp(drv->name, "hid-generic"))
+        return 0;
+    return hid_match_device(data, hdrv) != NULL;
+}
+
+// Same rules as hid-generic: Leave the device to any more specific driver.
+// Never reject a device, which hid-generic would leave to us (i.e. any our id table matches). Otherwise it would end up without any driver.
+static bool hid_mouse_match(struct hid_device *hdev, bool ignore_special_driver)
+{
+    if (ignore_special_driver)
+        return false;
+    if (hdev->quirks & HID_QUIRK_HAVE_SPECIAL_DRIVER)
+        return false;
+#ifdef HID_QUIRK_IGNORE_SPECIAL_DRIVER
+    if (hdev->quirks & HID_QUIRK_IGNORE_SPECIAL_DRIVER)
+        return false;
+#endif
+    return !bus_for_each_drv(&hid_bus_type, NULL, hdev, hid_mouse_check_other);
+}
+
+// Only devices with a mouse application collection get accelerated
+static bool hid_mouse_is_mouse(struct hid_device *hdev)
+{
+    unsigned int i;
+
+    for (i = 0; i < hdev->maxcollection; i++) {
+        if (hdev->collection[i].type == HID_COLLECTION_APPLICATION &&
+            hdev->collection[i].usage == HID_GD_MOUSE)
+            return true;
+    }
+    return false;
+}
+
+#ifdef HID_QUIRK_IGNORE_SPECIAL_DRIVER
+// Devices, which are no mice, but share the id of one (e.g. the keyboard interface of a gaming mouse), waiting to be reprobed.
+// HID_QUIRK_IGNORE_SPECIAL_DRIVER makes hid-generic take them and hid_mouse_match() skip them. The HID core resets the quirk, when it probes the next driver.
+struct hid_mouse_handback {
+    struct list_head list;
+    struct hid_device *hdev;
+};
+
+static LIST_HEAD(g_hid_mouse_handbacks);
+static DEFINE_MUTEX(g_hid_mouse_handbacks_lock);
+
+static void hid_mouse_handback_fn(struct work_struct *work)
+{
+    struct hid_mouse_handback *h;
+
+    for (;;) {
+        mutex_lock(&g_hid_mouse_handbacks_lock);
+        h = list_first_entry_or_null(&g_hid_mouse_handbacks, struct hid_mouse_handback, list);
+        if (h)
+            list_del(&h->list);
+        mutex_unlock(&g_hid_mouse_handbacks_lock);
+        if (!h)
+            break;
+
+        if (device_reprobe(&h->hdev->dev))
+            hid_warn(h->hdev, "failed to hand the device back to hid-generic\n");
+        put_device(&h->hdev->dev);
+        kfree(h);
+    }
+}
+
+static DECLARE_WORK(g_hid_mouse_handback_work, hid_mouse_handback_fn);
+
+// Called from the probe, which must fail with -ENODEV afterwards. The reprobe has to wait, until the driver core is done with this probe.
+static bool hid_mouse_handback(struct hid_device *hdev)
+{
+    struct hid_mouse_handback *h = kmalloc(sizeof(struct hid_mouse_handback), GFP_KERNEL);
+
+    if (!h)
+        return false;
+    h->hdev = hdev;
+    get_device(&hdev->dev);
+    hdev->quirks |= HID_QUIRK_IGNORE_SPECIAL_DRIVER;
+
+    mutex_lock(&g_hid_mouse_handbacks_lock);
+    list_add_tail(&h->list, &g_hid_mouse_handbacks);
+    mutex_unlock(&g_hid_mouse_handbacks_lock);
+    schedule_work(&g_hid_mouse_handback_work);
+    return true;
+}
+#else
+static bool hid_mouse_handback(struct hid_device *hdev)
+{
+    return false;
+}
+#endif
+
+// Adds a field of interest to a layout. Only the first field of each kind counts. Fields beyond the offsets a report_entry can hold are ignored.
+static void hid_mouse_entry(struct report_layout *l, struct report_entry *e, int bit, unsigned int offset, unsigned int size, bool sgn)
+{
+    if ((l->fields & bit) || offset > U8_MAX || !size || size > 32)
+        return;
+    e->offset = offset;
+    e->size = size;
+    e->sgn = sgn;
+    l->fields |= bit;
+}
+
+// Takes the layout of the mouse reports from the input reports the HID core parsed (i.e. after any fixups), since raw_event gets them in exactly this layout.
+// The HID core counts offsets from after the report ID. raw_event sees the report ID in front, if the reports are numbered.
+static void hid_mouse_layout(struct hid_device *hdev, struct report_positions *pos)
+{
+    struct hid_report_enum *re = hdev->report_enum + HID_INPUT_REPORT;
+    unsigned int base = re->numbered ? 8 : 0;
+    struct hid_report *report;
+    struct report_layout *l;
+    struct hid_field *f;
+    unsigned int i, n, offset;
+
+    memset(pos, 0, sizeof(struct report_positions));
+    pos->report_id_tagged = re->numbered;
+    list_for_each_entry(report, &re->report_list, list) {
+        if ((report->size + base + 7) / 8 > pos->report_len)
+            pos->report_len = (report->size + base + 7) / 8;
+        if (pos->num_layouts == NUM_LAYOUTS)
+            continue;
+
+        l = pos->layouts + pos->num_layouts;
+        l->id = report->id;
+        for (i = 0; i < report->maxfield; i++) {
+            f = report->field[i];
+            if (!f->maxusage)
+                continue;
+            // Buttons are taken as a whole, from the first field of buttons
+            if ((f->usage[0].hid & HID_USAGE_PAGE) == HID_UP_BUTTON) {
+                hid_mouse_entry(l, &l->button, REPORT_BUTTON, base + f->report_offset, f->report_size * f->report_count, f->logical_minimum < 0);
+                continue;
+            }
+            // The values of an array field do not belong to any fixed usage
+            if (!(f->flags & HID_MAIN_ITEM_VARIABLE))
+                continue;
+            for (n = 0; n < f->report_count && n < f->maxusage; n++) {
+                offset = base + f->report_offset + n * f->report_size;
+                switch (f->usage[n].hid) {
+                case HID_GD_X:
+                    hid_mouse_entry(l, &l->x, REPORT_X, offset, f->report_size, f->logical_minimum < 0);
+                    break;
+                case HID_GD_Y:
+                    hid_mouse_entry(l, &l->y, REPORT_Y, offset, f->report_size, f->logical_minimum < 0);
+                    break;
+                case HID_GD_WHEEL:
+                    hid_mouse_entry(l, &l->wheel, REPORT_WHEEL, offset, f->report_size, f->logical_minimum < 0);
+                    break;
+                }
+            }
+        }
+        if (l->fields)
+            pos->num_layouts++;
+        else
+            memset(l, 0, sizeof(struct report_layout));
+    }
+    compile_report_positions(pos);
+}
+
+// Polling interval of the interrupt endpoint in µs. 0 (i.e. the default of accel_init()) for anything else but USB.
+static unsigned int hid_mouse_interval(struct hid_device *hdev)
+{
+    struct usb_interface *intf;
+    struct usb_device *dev;
+    struct usb_endpoint_descriptor *ep;
+    unsigned int i;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5,16,0)
+    if (!hid_is_using_ll_driver(hdev, &usb_hid_driver))
+#else
+    if (!hid_is_usb(hdev))
+#endif
+        return 0;
+
+    intf = to_usb_interface(hdev->dev.parent);
+    dev = interface_to_usbdev(intf);
+    for (i = 0; i < intf->cur_altsetting->desc.bNumEndpoints; i++) {
+        ep = &intf->cur_altsetting->endpoint[i].desc;
+        if (!usb_endpoint_is_int_in(ep))
+            continue;
+        // High-speed (and faster) devices count in 125 µs microframes (as 2^(bInterval - 1)), full- and low-speed devices in 1 ms frames.
+        if (dev->speed >= USB_SPEED_HIGH)
+            return (1u << (clamp_t(int, ep->bInterval, 1, 16) - 1)) * 125;
+        return ep->bInterval * 1000;
+    }
+    return 0;
+}
+
+// ########## Packet path
+
+// Called by the HID core for every report, before it parses it. Mouse reports get accelerated in place, so hid-input reports the accelerated motion.
+static int hid_mouse_raw_event(struct hid_device *hdev, struct hid_report *report, u8 *data, int size)
+{
+    struct hid_mouse *mouse = hid_get_drvdata(hdev);
+    signed int btn, x, y, wheel, fields;
+    int in[3], out[3];
+    u64 stamp[LATENCY_STAGES];
+    char latency = READ_ONCE(g_latency);
+    int status;
+
+    if (!mouse || report->type != HID_INPUT_REPORT)
+        return 0;
+
+    if(latency) stamp[0] = ktime_get_ns();
+    stats_count(&mouse->stats, STAT_PACKETS);
+    trace_leetmouse_raw(data, size);
+    fields = extract_mouse_events(data, size, &mouse->pos, &btn, &x, &y, &wheel);
+    trace_leetmouse_decoded(fields, btn, x, y, wheel);
+    in[0] = x; in[1] = y; in[2] = wheel;
+    if(fields < 0 || !(fields & (REPORT_X | REPORT_Y | REPORT_WHEEL))){
+        capture_packet(&mouse->capture, data, size, fields, btn, in, x, y, wheel, min(fields, 0));
+        return 0;   //Nothing to accelerate. The HID core handles the report as usual.
+    }
+    if(latency) stamp[LATENCY_EXTRACT + 1] = ktime_get_ns();
+
+    status = accelerate(&mouse->accel, &x, &y, &wheel);
+    stats_count_accel(&mouse->stats, status);
+    if(status >= 0){
+        trace_leetmouse_accelerated(x, y, wheel);
+        motion_packet(&mouse->motion, in, x, y, mouse->accel.speed, mouse->accel.sens);
+    } else {
+        //The motion got buffered for the next packet. Drop it from this one.
+        trace_leetmouse_accel_error(status);
+        x = y = wheel = 0;
+    }
+    if(latency) stamp[LATENCY_ACCEL + 1] = ktime_get_ns();
+
+    //Motion beyond the range of a field is clamped, since the report cannot carry it. The rest goes out with the next packet.
+    out[0] = x; out[1] = y; out[2] = wheel;
+    insert_mouse_events(data, &mouse->pos, fields, &x, &y, &wheel);
+    accel_clipped(&mouse->accel, out[0] - x, out[1] - y, out[2] - wheel);
+    if(latency){
+        stamp[LATENCY_REPORT + 1] = ktime_get_ns();
+        latency_record_all(&mouse->stats, stamp);
+    }
+    capture_packet(&mouse->capture, data, size, fields, btn, in, x, y, wheel, status);
+
+    return 0;
+}
+
+// ########## Binding
+
+static int hid_mouse_probe(struct hid_device *hdev, const struct hid_device_id *id)
+{
+    struct hid_mouse *mouse = NULL;
+    int ret;
+
+    ret = hid_parse(hdev);
+    if (ret)
+        return ret;
+
+    // Other interfaces of a mouse are not ours. If they cannot be handed back, they are passed through.
+    if (!hid_mouse_is_mouse(hdev) && hid_mouse_handback(hdev))
+        return -ENODEV;
+
+    if (hid_mouse_is_mouse(hdev)) {
+        mouse = kzalloc(sizeof(struct hid_mouse), GFP_KERNEL);
+        if (!mouse)
+            return -ENOMEM;
+
+        hid_mouse_layout(hdev, &mouse->pos);
+        if (!mouse->pos.num_layouts) {
+            hid_warn(hdev, "no mouse data found in the report descriptor. Passing it through.\n");
+            kfree(mouse);
+            mouse = NULL;
+        }
+    }
+
+    if (mouse) {
+        accel_init(&mouse->accel, hid_mouse_interval(hdev));
+        ret = stats_init(&mouse->stats);
+        if (ret)
+            goto fail1;
+    }
+    hid_set_drvdata(hdev, mouse);
+
+    ret = hid_hw_start(hdev, HID_CONNECT_DEFAULT);
+    if (ret)
+        goto fail2;
+
+    // Statistics and the debugging aids are optional. The mouse works without them.
+    if (mouse) {
+        if (stats_sysfs_add(&mouse->stats, &hdev->dev))
+            hid_warn(hdev, "failed to create the leetmouse sysfs group\n");
+        capture_add(&mouse->capture, dev_name(&hdev->dev));
+        if (motion_add(&mouse->motion, &hdev->dev))
+            hid_warn(hdev, "failed to create the leetmouse motion stream\n");
+    }
+
+    return 0;
+
+fail2:
+    hid_set_drvdata(hdev, NULL);
+    if (mouse)
+        stats_release(&mouse->stats);
+fail1:
+    if (mouse) {
+        accel_release(&mouse->accel);
+        kfree(mouse);
+    }
+    return ret;
+}
+
+static void hid_mouse_remove(struct hid_device *hdev)
+{
+    struct hid_mouse *mouse = hid_get_drvdata(hdev);
+
+    if (mouse)
+        stats_sysfs_remove(&mouse->stats, &hdev->dev);
+    hid_hw_stop(hdev);
+    if (mouse) {
+        capture_remove(&mouse->capture);
+        motion_remove(&mouse->motion);
+        stats_release(&mouse->stats);
+        accel_release(&mouse->accel);
+        kfree(mouse);
+    }
+}
+
+static struct hid_driver hid_mouse_driver = {
+    .name        = "leetmouse",
+    .id_table    = hid_mouse_id_table,
+    .match       = hid_mouse_match,
+    .probe       = hid_mouse_probe,
+    .remove      = hid_mouse_remove,
+    .raw_event   = hid_mouse_raw_event,
+};
+
+bool hid_mouse_enabled(void)
+{
+    return g_hid_bind;
+}
+
+// Learns the mice already present, before registering. Registering reprobes every device hid-generic had taken, but would leave to us now.
+int hid_mouse_register(void)
+{
+    int ret;
+
+    if (!g_hid_bind)
+        return 0;
+    ret = bus_register_notifier(&hid_bus_type, &hid_mouse_nb);
+    if (ret)
+        return ret;
+    bus_for_each_dev(&hid_bus_type, NULL, NULL, hid_mouse_learn_one);
+    ret = hid_register_driver(&hid_mouse_driver);
+    if (ret)
+        bus_unregister_notifier(&hid_bus_type, &hid_mouse_nb);
+    return ret;
+}
+
+void hid_mouse_unregister(void)
+{
+    if (g_hid_bind) {
+        hid_unregister_driver(&hid_mouse_driver);
+        bus_unregister_notifier(&hid_bus_type, &hid_mouse_nb);
+#ifdef HID_QUIRK_IGNORE_SPECIAL_DRIVER
+        // Pending hand backs still go to hid-generic
+        flush_work(&g_hid_mouse_handback_work);
+#endif
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef _HIDMOUSE_H
+#define _HIDMOUSE_H
+
+#include <linux/types.h>
+
+// Registers the HID driver, if enabled via the hid_bind parameter. The USB driver stays registered, but refuses any mouse then (see hid_mouse_enabled()).
+int hid_mouse_register(void);
+void hid_mouse_unregister(void);
+
+// Whether mice are taken via the HID core. Binding a mouse to the USB driver would take it away from usbhid and thus from the HID driver, so both are mutually exclusive.
+bool hid_mouse_enabled(void);
+
+#endif  //_HIDMOUSE_H
@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+// Tracepoints along the packet path. They cost nothing, unless enabled via ftrace or perf, e.g.
+//   echo 1 > /sys/kernel/tracing/events/leetmouse/enable && cat /sys/kernel/tracing/trace_pipe
+//   perf record -e 'leetmouse:*' -a
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM leetmouse
+
+#if !defined(_LEETMOUSE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LEETMOUSE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Raw packet as received from the device
+TRACE_EVENT(leetmouse_raw,
+    TP_PROTO(const unsigned char *data, int len),
+    TP_ARGS(data, len),
+
+    TP_STRUCT__entry(
+        __field(int, len)
+        __dynamic_array(unsigned char, data, len)
+    ),
+
+    TP_fast_assign(
+        __entry->len = len;
+        memcpy(__get_dynamic_array(data), data, len);
+    ),
+
+    TP_printk("len=%d data=%s", __entry->len, __print_hex(__get_dynamic_array(data), __entry->len))
+);
+
+// Mouse data extracted from a packet. fields is the return value of extract_mouse_events(): A REPORT_* bitmask or a negative error code for rejected packets.
+TRACE_EVENT(leetmouse_decoded,
+    TP_PROTO(int fields, int btn, int x, int y, int wheel),
+    TP_ARGS(fields, btn, x, y, wheel),
+
+    TP_STRUCT__entry(
+        __field(int, fields)
+        __field(int, btn)
+        __field(int, x)
+        __field(int, y)
+        __field(int, wheel)
+    ),
+
+    TP_fast_assign(
+        __entry->fields = fields;
+        __entry->btn = btn;
+        __entry->x = x;
+        __entry->y = y;
+        __entry->wheel = wheel;
+    ),
+
+    TP_printk("fields=%d btn=0x%x x=%d y=%d wheel=%d", __entry->fields, __entry->btn, __entry->x, __entry->y, __entry->wheel)
+);
+
+// Deltas after a successful acceleration
+TRACE_EVENT(leetmouse_accelerated,
+    TP_PROTO(int x, int y, int wheel),
+    TP_ARGS(x, y, wheel),
+
+    TP_STRUCT__entry(
+        __field(int, x)
+        __field(int, y)
+        __field(int, wheel)
+    ),
+
+    TP_fast_assign(
+        __entry->x = x;
+        __entry->y = y;
+        __entry->wheel = wheel;
+    ),
+
+    TP_printk("x=%d y=%d wheel=%d", __entry->x, __entry->y, __entry->wheel)
+);
+
+// accelerate() failed: One of the float traps triggered (-EFAULT) or the result was not finite (-EDOM). The motion got buffered for the next packet.
+TRACE_EVENT(leetmouse_accel_error,
+    TP_PROTO(int status),
+    TP_ARGS(status),
+
+    TP_STRUCT__entry(
+        __field(int, status)
+    ),
+
+    TP_fast_assign(
+        __entry->status = status;
+    ),
+
+    TP_printk("status=%d", __entry->status)
+);
+
+// The URB completed with an error (other than being unlinked) and gets resubmitted
+TRACE_EVENT(leetmouse_urb_error,
+    TP_PROTO(int status),
+    TP_ARGS(status),
+
+    TP_STRUCT__entry(
+        __field(int, status)
+    ),
+
+    TP_fast_assign(
+        __entry->status = status;
+    ),
+
+    TP_printk("status=%d", __entry->status)
+);
+
+#endif /* _LEETMOUSE_TRACE_H */
+
+// This part must be outside the header guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE leetmouse_trace
+#include <trace/define_trace.h>
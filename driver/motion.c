@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "motion.h"
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/idr.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/log2.h>
+
+// ########## Kernel module parameters
+static unsigned int g_motion_size = 16384;
+module_param_named(motion_size, g_motion_size, uint, 0644);
+MODULE_PARM_DESC(motion_size, "Number of records in the ring of the motion stream, allocated when its device is opened (rounded up to a power of 2).");
+
+#define MOTION_MIN_SIZE 64
+#define MOTION_MAX_SIZE (1 << 20)
+
+struct motion_ring {
+    struct motion_header *hdr;      // Start of the mapping (vmalloc_user(), so it is zeroed and can be mapped to userspace)
+    struct motion_record *rec;
+    u32 mask;
+    wait_queue_head_t wait;
+    struct motion *m;               // Device streaming into this ring. NULL, once the device is gone.
+};
+
+static DEFINE_IDA(g_motion_ida);
+static DEFINE_MUTEX(g_motion_lock);     // Serializes attaching rings to devices and detaching them
+
+// The indices live in memory shared with userspace. The reader can only ever hurt its own stream with a bogus tail, since every index gets masked.
+void motion_write(struct motion_ring *ring, u64 ts, const int *in, int x, int y, s32 speed, s32 sens)
+{
+    struct motion_header *hdr = ring->hdr;
+    u32 head = hdr->head;
+    struct motion_record *r;
+
+    if(head - smp_load_acquire(&hdr->tail) > ring->mask){
+        WRITE_ONCE(hdr->dropped, hdr->dropped + 1);
+        return;
+    }
+
+    r = &ring->rec[head & ring->mask];
+    r->ts = ts;
+    r->x = in[0];
+    r->y = in[1];
+    r->speed = speed;
+    r->sens = sens;
+    r->out_x = x;
+    r->out_y = y;
+    smp_store_release(&hdr->head, head + 1);
+
+    //A reader following the ring from memory never sleeps. Only wake up the ones waiting in poll().
+    if(wq_has_sleeper(&ring->wait))
+        wake_up_interruptible(&ring->wait);
+}
+
+// ########## Character device
+
+// A single reader at a time. It gets a fresh, empty ring.
+static int motion_open(struct inode *inode, struct file *file)
+{
+    struct motion *m = container_of(file->private_data, struct motion, misc);
+    struct motion_ring *ring;
+    u32 size = roundup_pow_of_two(clamp_t(u32, READ_ONCE(g_motion_size), MOTION_MIN_SIZE, MOTION_MAX_SIZE));
+    size_t offset = PAGE_ALIGN(sizeof(struct motion_header));
+
+    ring = kzalloc(sizeof(struct motion_ring), GFP_KERNEL);
+    if(!ring)
+        return -ENOMEM;
+    ring->hdr = vmalloc_user(PAGE_ALIGN(offset + size * sizeof(struct motion_record)));
+    if(!ring->hdr){
+        kfree(ring);
+        return -ENOMEM;
+    }
+    ring->hdr->version = MOTION_VERSION;
+    ring->hdr->size = size;
+    ring->hdr->record_size = sizeof(struct motion_record);
+    ring->hdr->offset = offset;
+    ring->rec = (struct motion_record *) ((char *) ring->hdr + offset);
+    ring->mask = size - 1;
+    init_waitqueue_head(&ring->wait);
+
+    mutex_lock(&g_motion_lock);
+    if(rcu_access_pointer(m->ring)){
+        mutex_unlock(&g_motion_lock);
+        vfree(ring->hdr);
+        kfree(ring);
+        return -EBUSY;
+    }
+    ring->m = m;
+    rcu_assign_pointer(m->ring, ring);
+    mutex_unlock(&g_motion_lock);
+
+    file->private_data = ring;
+    return nonseekable_open(inode, file);
+}
+
+// Called once the file is closed and unmapped, which might be long after the device is gone
+static int motion_release(struct inode *inode, struct file *file)
+{
+    struct motion_ring *ring = file->private_data;
+
+    mutex_lock(&g_motion_lock);
+    if(ring->m)
+        RCU_INIT_POINTER(ring->m->ring, NULL);
+    mutex_unlock(&g_motion_lock);
+
+    synchronize_rcu();      // The packet path might still be writing into the ring
+    vfree(ring->hdr);
+    kfree(ring);
+    return 0;
+}
+
+static int motion_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct motion_ring *ring = file->private_data;
+
+    return remap_vmalloc_range(vma, ring->hdr, vma->vm_pgoff);
+}
+
+static __poll_t motion_poll(struct file *file, poll_table *wait)
+{
+    struct motion_ring *ring = file->private_data;
+
+    poll_wait(file, &ring->wait, wait);
+    if(smp_load_acquire(&ring->hdr->head) != READ_ONCE(ring->hdr->tail))
+        return EPOLLIN | EPOLLRDNORM;
+    if(!READ_ONCE(ring->m))
+        return EPOLLHUP;
+    return 0;
+}
+
+static const struct file_operations motion_fops = {
+    .owner   = THIS_MODULE,
+    .open    = motion_open,
+    .release = motion_release,
+    .mmap    = motion_mmap,
+    .poll    = motion_poll,
+};
+
+// ########## Devices
+
+// Registers /dev/leetmouse_motion<n> for a mouse
+int motion_add(struct motion *m, struct device *parent)
+{
+    int ret;
+
+    RCU_INIT_POINTER(m->ring, NULL);
+    m->id = ida_alloc(&g_motion_ida, GFP_KERNEL);
+    if(m->id < 0)
+        return m->id;
+
+    snprintf(m->name, sizeof(m->name), "leetmouse_motion%d", m->id);
+    m->misc.minor = MISC_DYNAMIC_MINOR;
+    m->misc.name = m->name;
+    m->misc.fops = &motion_fops;
+    m->misc.parent = parent;
+    ret = misc_register(&m->misc);
+    if(ret){
+        ida_free(&g_motion_ida, m->id);
+        m->misc.name = NULL;
+    }
+    return ret;
+}
+
+// Must be called, after the packet path of the device has been stopped.
+// A reader still holding the ring keeps it (and its mapping), but gets EPOLLHUP.
+void motion_remove(struct motion *m)
+{
+    struct motion_ring *ring;
+
+    if(!m->misc.name)
+        return;
+    //No new readers after this. An open running concurrently has finished, too.
+    misc_deregister(&m->misc);
+
+    mutex_lock(&g_motion_lock);
+    ring = rcu_dereference_protected(m->ring, lockdep_is_held(&g_motion_lock));
+    if(ring){
+        RCU_INIT_POINTER(m->ring, NULL);
+        WRITE_ONCE(ring->m, NULL);
+        wake_up_interruptible(&ring->wait);
+    }
+    mutex_unlock(&g_motion_lock);
+
+    ida_free(&g_motion_ida, m->id);
+    m->misc.name = NULL;
+}
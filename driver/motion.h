@@ -0,0 +1,72 @@
+#ifndef _MOTION_H
+#define _MOTION_H
+
+#include <linux/types.h>
+
+// Motion stream. Every mouse gets a character device /dev/leetmouse_motion<n> (/sys/class/misc/leetmouse_motion<n>/device leads to the mouse).
+// Mapping it gives a single-producer/single-consumer ring of motion records, which the driver fills for every accelerated packet.
+// A reader follows the ring straight from memory. It only needs poll() to sleep, once it caught up with the driver.
+//
+// The mapping starts with struct motion_header, followed by the records at offset header.offset:
+//   - The driver only writes head, after the record has been written. Read it with acquire semantics.
+//   - The reader writes tail (with release semantics), once it is done with the records before it. Records are dropped, while the ring is full.
+// Both are free-running counters: Record i lives at index (i & (size - 1)).
+
+#define MOTION_VERSION 1
+
+struct motion_record {
+    __u64 ts;               // Time in ns (CLOCK_MONOTONIC), when the packet got accelerated
+    __s32 x, y;             // Motion as reported by the mouse
+    __s32 speed;            // Input speed in counts/ms (before the offset), Q16.16
+    __s32 sens;             // Sensitivity applied (to X, when accelerating by component), relative to the Sensitivity parameter, Q16.16
+    __s32 out_x, out_y;     // Motion after acceleration
+};
+
+struct motion_header {
+    __u32 version;          // MOTION_VERSION
+    __u32 size;             // Number of records (a power of 2)
+    __u32 record_size;      // sizeof(struct motion_record)
+    __u32 offset;           // Offset of the first record from the start of the mapping
+    __u32 head __attribute__((aligned(64)));    // Written by the driver only
+    __u32 dropped;          // Records dropped, since the ring was full
+    __u32 tail __attribute__((aligned(64)));    // Written by the reader only
+};
+
+#ifdef __KERNEL__
+
+#include "util.h"
+#include <linux/rcupdate.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+
+struct motion_ring;
+
+// Per-device motion stream
+struct motion {
+    struct motion_ring __rcu *ring;     // Set while the device node is open
+    struct miscdevice misc;     // misc.name is NULL, unless registered
+    char name[32];
+    int id;
+};
+
+void motion_write(struct motion_ring *ring, u64 ts, const int *in, int x, int y, s32 speed, s32 sens);
+
+// Streams an accelerated packet, if somebody reads the stream. in holds the motion as reported by the mouse, x and y the accelerated one.
+// Must be called from the packet path of the device (which never runs concurrently with itself).
+static INLINE void motion_packet(struct motion *m, const int *in, int x, int y, s32 speed, s32 sens)
+{
+    struct motion_ring *ring;
+
+    rcu_read_lock();
+    ring = rcu_dereference(m->ring);
+    if(unlikely(ring))
+        motion_write(ring, ktime_get_ns(), in, x, y, speed, sens);
+    rcu_read_unlock();
+}
+
+int motion_add(struct motion *m, struct device *parent);
+void motion_remove(struct motion *m);
+
+#endif  //__KERNEL__
+
+#endif  //_MOTION_H
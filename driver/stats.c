@@ -0,0 +1,143 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+
+#include "stats.h"
+#include <linux/kernel.h>
+#include <linux/string.h>   //memset
+
+// ########## Kernel module parameters
+#include <linux/module.h>
+char g_latency = 0;
+module_param_named(latency, g_latency, byte, 0644);
+MODULE_PARM_DESC(latency, "Measure the latency of every packet within the driver. See the 'leetmouse' directory of the bound device in sysfs.");
+
+int stats_init(struct leetmouse_stats *stats)
+{
+    memset(stats->latency, 0, sizeof(stats->latency));
+    stats->counters = alloc_percpu(struct stats_counters);
+    return stats->counters ? 0 : -ENOMEM;
+}
+
+void stats_release(struct leetmouse_stats *stats)
+{
+    free_percpu(stats->counters);
+    stats->counters = NULL;
+}
+
+//Clears the latency histograms. The counters keep on counting.
+void stats_reset(struct leetmouse_stats *stats)
+{
+    memset(stats->latency, 0, sizeof(stats->latency));
+}
+
+//Sums up a counter over all CPUs
+u64 stats_counter_sum(const struct leetmouse_stats *stats, enum stats_counter counter)
+{
+    u64 sum = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        sum += per_cpu_ptr(stats->counters, cpu)->count[counter];
+    return sum;
+}
+
+//Prints a histogram one bucket per line: The lower bound of the bucket in ns, followed by the number of packets within that bucket
+ssize_t latency_hist_show(const struct latency_hist *hist, char *buf)
+{
+    ssize_t len = 0;
+    int i;
+
+    for(i = 0; i < LATENCY_BUCKETS; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%llu %u\n", i ? 1ull << i : 0, READ_ONCE(hist->count[i]));
+    return len;
+}
+
+// ########## sysfs
+
+//Names of the attributes, in the order of enum latency_stage and enum stats_counter
+static const char * const latency_names[LATENCY_STAGES] = {
+    "latency_extract",
+    "latency_accel",
+    "latency_report",
+    "latency_total",
+};
+
+static const char * const counter_names[STAT_COUNTERS] = {
+    "packets",
+    "accelerated",
+    "fpu_busy",
+    "float_traps",
+    "nan",
+    "overflows",
+    "resubmit_failures",
+};
+
+static ssize_t latency_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct stats_attribute *a = container_of(attr, struct stats_attribute, attr);
+
+    return latency_hist_show(&a->stats->latency[a->index], buf);
+}
+
+static ssize_t counter_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct stats_attribute *a = container_of(attr, struct stats_attribute, attr);
+
+    return scnprintf(buf, PAGE_SIZE, "%llu\n", stats_counter_sum(a->stats, a->index));
+}
+
+//Writing anything clears all histograms
+static ssize_t latency_reset_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    struct stats_attribute *a = container_of(attr, struct stats_attribute, attr);
+
+    stats_reset(a->stats);
+    return count;
+}
+
+static void stats_attr_init(struct leetmouse_stats *stats, int n, const char *name, int index)
+{
+    struct stats_attribute *a = stats->attrs + n;
+
+    sysfs_attr_init(&a->attr.attr);
+    a->attr.attr.name = name;
+    a->stats = stats;
+    a->index = index;
+    stats->attr_list[n] = &a->attr.attr;
+}
+
+//Creates the "leetmouse" directory with all statistics of the device. The attributes live within stats, so they never outlive it.
+int stats_sysfs_add(struct leetmouse_stats *stats, struct device *dev)
+{
+    int i, n = 0, ret;
+
+    for(i = 0; i < LATENCY_STAGES; i++){
+        stats_attr_init(stats, n, latency_names[i], i);
+        stats->attrs[n].attr.attr.mode = 0444;
+        stats->attrs[n++].attr.show = latency_show;
+    }
+
+    stats_attr_init(stats, n, "latency_reset", 0);
+    stats->attrs[n].attr.attr.mode = 0200;
+    stats->attrs[n++].attr.store = latency_reset_store;
+
+    for(i = 0; i < STAT_COUNTERS; i++){
+        stats_attr_init(stats, n, counter_names[i], i);
+        stats->attrs[n].attr.attr.mode = 0444;
+        stats->attrs[n++].attr.show = counter_show;
+    }
+    stats->attr_list[n] = NULL;
+
+    stats->group.name = "leetmouse";
+    stats->group.attrs = stats->attr_list;
+    ret = sysfs_create_group(&dev->kobj, &stats->group);
+    if(ret)
+        stats->group.attrs = NULL;
+    return ret;
+}
+
+//Removes the "leetmouse" directory again. Returns only after all readers and writers of the attributes are gone.
+void stats_sysfs_remove(struct leetmouse_stats *stats, struct device *dev)
+{
+    if(stats->group.attrs)
+        sysfs_remove_group(&dev->kobj, &stats->group);
+}
@@ -0,0 +1,120 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "util.h"
+#include "accel.h"
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/device.h>
+#include <linux/percpu.h>
+#include <linux/errno.h>
+
+// Per-device statistics, exposed via sysfs in the "leetmouse" directory of the bound device (the USB interface or the HID device)
+
+//Latencies are collected in log-scale histograms: Bucket i counts latencies within [2^i, 2^(i+1)) ns. The last bucket also collects everything above (~8 ms and more).
+#define LATENCY_BUCKETS 24
+
+//Stages of the packet path, measured from entering the URB completion handler until input_sync() returned
+enum latency_stage {
+    LATENCY_EXTRACT,        //Extraction of the mouse data from the raw packet
+    LATENCY_ACCEL,          //Acceleration
+    LATENCY_REPORT,         //Reporting to the input subsystem (up to input_sync())
+    LATENCY_TOTAL,          //All of the above
+    LATENCY_STAGES
+};
+
+struct latency_hist {
+    u32 count[LATENCY_BUCKETS];
+};
+
+//Event counters. They are kept per CPU, so counting never needs atomics or bounces a cache line between CPUs.
+enum stats_counter {
+    STAT_PACKETS,           //Packets received
+    STAT_ACCELERATED,       //Packets successfully accelerated
+    STAT_FPU_BUSY,          //Packets accelerated by the fixed-point engine, since the FPU was unusable
+    STAT_FLOAT_TRAPS,       //Motion buffered, since a float trap triggered
+    STAT_NAN,               //Motion buffered, since the acceleration was not finite
+    STAT_OVERFLOWS,         //URBs completed with -EOVERFLOW
+    STAT_RESUBMIT_FAILURES, //URBs, which could not be resubmitted
+    STAT_COUNTERS
+};
+
+struct stats_counters {
+    u64 count[STAT_COUNTERS];
+};
+
+//A sysfs attribute of one device. It finds the statistics of its device on its own, so both drivers share the same attributes.
+struct stats_attribute {
+    struct device_attribute attr;
+    struct leetmouse_stats *stats;
+    int index;              //Latency stage or counter shown
+};
+
+//Latency histograms, their reset and all counters
+#define STATS_ATTRS (LATENCY_STAGES + 1 + STAT_COUNTERS)
+
+struct leetmouse_stats {
+    struct latency_hist latency[LATENCY_STAGES];
+    struct stats_counters __percpu *counters;
+
+    struct stats_attribute attrs[STATS_ATTRS];
+    struct attribute *attr_list[STATS_ATTRS + 1];
+    struct attribute_group group;
+};
+
+extern char g_latency;
+
+//Counts a latency in its bucket. Cheap enough to be called for every packet.
+static INLINE void latency_record(struct latency_hist *hist, u64 ns)
+{
+    int bucket = fls64(ns) - 1;
+
+    if(bucket < 0) bucket = 0;
+    if(bucket >= LATENCY_BUCKETS) bucket = LATENCY_BUCKETS - 1;
+    WRITE_ONCE(hist->count[bucket], hist->count[bucket] + 1);
+}
+
+//Records the time spent between the timestamps of all stages. stamp[0] is taken when entering the completion handler, stamp[i + 1] after stage i.
+static INLINE void latency_record_all(struct leetmouse_stats *stats, const u64 *stamp)
+{
+    int i;
+
+    for(i = 0; i < LATENCY_TOTAL; i++)
+        latency_record(&stats->latency[i], stamp[i + 1] - stamp[i]);
+    latency_record(&stats->latency[LATENCY_TOTAL], stamp[LATENCY_TOTAL] - stamp[0]);
+}
+
+static INLINE void stats_count(struct leetmouse_stats *stats, enum stats_counter counter)
+{
+    this_cpu_inc(stats->counters->count[counter]);
+}
+
+//Counts the outcome of accelerate()
+static INLINE void stats_count_accel(struct leetmouse_stats *stats, int status)
+{
+    switch(status){
+    case ACCEL_FALLBACK:
+        stats_count(stats, STAT_FPU_BUSY);
+        stats_count(stats, STAT_ACCELERATED);
+        break;
+    case 0:
+        stats_count(stats, STAT_ACCELERATED);
+        break;
+    case -EDOM:
+        stats_count(stats, STAT_NAN);
+        break;
+    default:
+        stats_count(stats, STAT_FLOAT_TRAPS);
+        break;
+    }
+}
+
+int stats_init(struct leetmouse_stats *stats);
+void stats_release(struct leetmouse_stats *stats);
+void stats_reset(struct leetmouse_stats *stats);
+u64 stats_counter_sum(const struct leetmouse_stats *stats, enum stats_counter counter);
+ssize_t latency_hist_show(const struct latency_hist *hist, char *buf);
+int stats_sysfs_add(struct leetmouse_stats *stats, struct device *dev);
+void stats_sysfs_remove(struct leetmouse_stats *stats, struct device *dev);
+
+#endif  //_STATS_H
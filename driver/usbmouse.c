@@ -16,6 +16,14 @@
 #include "accel.h"
 #include "config.h"
 #include "util.h"
+#include "stats.h"
+#include "desc_cache.h"
+#include "hidmouse.h"
+#include "capture.h"
+#include "motion.h"
+
+#define CREATE_TRACE_POINTS
+#include "leetmouse_trace.h"
                                                                 //Leetmouse Mod END
 
 #include <linux/kernel.h>
@@ -44,25 +52,55 @@ MODULE_AUTHOR(DRIVER_AUTHOR);
 MODULE_DESCRIPTION(DRIVER_DESC);
 MODULE_LICENSE("GPL");
 
+                                                                //Leetmouse Mod BEGIN
+// Number of URBs kept in flight, when "config.h" does not choose one
+#ifndef NUM_URBS
+#define NUM_URBS 2
+#endif
+#define MAX_URBS 4
+
+static unsigned char g_urbs = NUM_URBS;
+module_param_named(urbs, g_urbs, byte, 0444);
+MODULE_PARM_DESC(urbs, "Number of URBs kept in flight per mouse (1-4).");
+                                                                //Leetmouse Mod END
+
 struct usb_mouse {
     char name[128];
     char phys[64];
     struct usb_device *usbdev;
     struct input_dev *dev;
-    struct urb *irq;
-
-    signed char *data;
-    dma_addr_t data_dma;
+                                                                //Leetmouse Mod BEGIN
+    // Ring of URBs, each with its own DMA buffer. All of them are in flight at once, so the host controller can already poll the mouse again, while we are still processing a packet.
+    // The USB core completes URBs of the same endpoint strictly in the order they were submitted. Since every URB gets resubmitted at the end of its completion, they keep on cycling in order.
+    struct urb *irq[MAX_URBS];
+    unsigned char *data[MAX_URBS];
+    dma_addr_t data_dma[MAX_URBS];
+    int data_len;       // Size of each transfer buffer
+    int num_urbs;
+
+    // Power management. The URBs are only in flight, while the input device is open and the interface is not suspended.
+    struct usb_interface *intf;
+    struct mutex pm_mutex;
+    bool is_open;
+                                                                //Leetmouse Mod END
 
     struct report_positions *data_pos;
+
+    struct accel_state accel;                                   //Leetmouse Mod
+    struct leetmouse_stats stats;                               //Leetmouse Mod
+    struct capture capture;                                     //Leetmouse Mod
+    struct motion motion;                                       //Leetmouse Mod
 };
 
 static void usb_mouse_irq(struct urb *urb)
 {
     struct usb_mouse *mouse = urb->context;
-    signed char *data = mouse->data;
+    unsigned char *data = urb->transfer_buffer;                 //Leetmouse Mod
     struct input_dev *dev = mouse->dev;
-    signed int btn, x, y, wheel;                                 //Leetmouse Mod
+    signed int btn, x, y, wheel, fields;                         //Leetmouse Mod
+    int in[3];                                                  //Leetmouse Mod
+    u64 stamp[LATENCY_STAGES];                                  //Leetmouse Mod
+    char latency = READ_ONCE(g_latency);                        //Leetmouse Mod
     int status;
 
     switch (urb->status) {
@@ -74,56 +112,177 @@ static void usb_mouse_irq(struct urb *urb)
         return;
                                                                 //Leetmouse Mod BEGIN
     case -EOVERFLOW:
-        printk("LEETMOUSE: EOVERFLOW. Try to increase BUFFER_SIZE from %d to %d in 'config.h'", BUFFER_SIZE, 2*BUFFER_SIZE);
+        printk("LEETMOUSE: EOVERFLOW. The mouse sent more than the %d bytes announced by its descriptors", mouse->data_len);
+        stats_count(&mouse->stats, STAT_OVERFLOWS);
+        trace_leetmouse_urb_error(urb->status);
         goto resubmit;
                                                                 //Leetmouse Mod END
     /* -EPIPE:  should clear the halt */
     default:        /* error */
+        trace_leetmouse_urb_error(urb->status);                 //Leetmouse Mod
         goto resubmit;
     }
 
                                                                 //Leetmouse Mod BEGIN
-    if(!extract_mouse_events(data, BUFFER_SIZE, mouse->data_pos, &btn, &x, &y, &wheel)){
+    if(latency) stamp[0] = ktime_get_ns();
+    stats_count(&mouse->stats, STAT_PACKETS);
+    trace_leetmouse_raw(data, urb->actual_length);
+    fields = extract_mouse_events(data, urb->actual_length, mouse->data_pos, &btn, &x, &y, &wheel);
+    trace_leetmouse_decoded(fields, btn, x, y, wheel);
+    in[0] = x; in[1] = y; in[2] = wheel;
+    if(fields < 0){
+        capture_packet(&mouse->capture, data, urb->actual_length, fields, btn, in, x, y, wheel, fields);
+        goto resubmit;  //Not a report with mouse data (e.g. from another report ID)
+    }
+    if(latency) stamp[LATENCY_EXTRACT + 1] = ktime_get_ns();
+
+    //Only accelerate reports with motion
+    status = 0;
+    if(fields & (REPORT_X | REPORT_Y | REPORT_WHEEL)){
+        status = accelerate(&mouse->accel,&x,&y,&wheel);
+        stats_count_accel(&mouse->stats, status);
+        if(status >= 0){
+            trace_leetmouse_accelerated(x, y, wheel);
+            motion_packet(&mouse->motion, in, x, y, mouse->accel.speed, mouse->accel.sens);
+        } else {
+            trace_leetmouse_accel_error(status);
+            fields &= ~(REPORT_X | REPORT_Y | REPORT_WHEEL);
+            x = y = wheel = 0;
+        }
+    }
+    if(latency) stamp[LATENCY_ACCEL + 1] = ktime_get_ns();
+
+    //Only touch the buttons, if this report carries them. Otherwise held buttons would be released.
+    if(fields & REPORT_BUTTON){
         input_report_key(dev, BTN_LEFT,   btn & 0x01);
         input_report_key(dev, BTN_RIGHT,  btn & 0x02);
         input_report_key(dev, BTN_MIDDLE, btn & 0x04);
         input_report_key(dev, BTN_SIDE,   btn & 0x08);
         input_report_key(dev, BTN_EXTRA,  btn & 0x10);
-        if(!accelerate(&x,&y,&wheel)){
-            input_report_rel(dev, REL_X,     x);
-            input_report_rel(dev, REL_Y,     y);
-            input_report_rel(dev, REL_WHEEL, wheel);
-        }
     }
-                                                                //Leetmouse Mod END
+    if(fields & (REPORT_X | REPORT_Y | REPORT_WHEEL)){
+        input_report_rel(dev, REL_X,     x);
+        input_report_rel(dev, REL_Y,     y);
+        input_report_rel(dev, REL_WHEEL, wheel);
+    }
 
     input_sync(dev);
+    usb_mark_last_busy(mouse->usbdev);     // Autosuspend only kicks in, after the mouse has been idle for a while
+    if(latency){
+        stamp[LATENCY_REPORT + 1] = ktime_get_ns();
+        latency_record_all(&mouse->stats, stamp);
+    }
+    capture_packet(&mouse->capture, data, urb->actual_length, fields, btn, in, x, y, wheel, status);
+                                                                //Leetmouse Mod END
 resubmit:
     status = usb_submit_urb (urb, GFP_ATOMIC);
-    if (status)
+    if (status) {                                               //Leetmouse Mod
+        stats_count(&mouse->stats, STAT_RESUBMIT_FAILURES);     //Leetmouse Mod
         dev_err(&mouse->usbdev->dev,
             "can't resubmit intr, %s-%s/input0, status %d\n",
             mouse->usbdev->bus->bus_name,
             mouse->usbdev->devpath, status);
+    }                                                           //Leetmouse Mod
+}
+
+                                                                //Leetmouse Mod BEGIN
+static void usb_mouse_kill_urbs(struct usb_mouse *mouse)
+{
+    int i;
+
+    for (i = 0; i < mouse->num_urbs; i++)
+        usb_kill_urb(mouse->irq[i]);
+}
+
+static int usb_mouse_submit_urbs(struct usb_mouse *mouse, gfp_t mem_flags)
+{
+    int i;
+
+    for (i = 0; i < mouse->num_urbs; i++) {
+        mouse->irq[i]->dev = mouse->usbdev;
+        if (usb_submit_urb(mouse->irq[i], mem_flags)) {
+            usb_mouse_kill_urbs(mouse);
+            return -EIO;
+        }
+    }
+
+    return 0;
 }
 
 static int usb_mouse_open(struct input_dev *dev)
 {
     struct usb_mouse *mouse = input_get_drvdata(dev);
+    int ret;
 
-    mouse->irq->dev = mouse->usbdev;
-    if (usb_submit_urb(mouse->irq, GFP_KERNEL))
-        return -EIO;
+    ret = usb_autopm_get_interface(mouse->intf) ? -EIO : 0;
+    if (ret < 0)
+        return ret;
 
-    return 0;
+    mutex_lock(&mouse->pm_mutex);
+    ret = usb_mouse_submit_urbs(mouse, GFP_KERNEL);
+    if (!ret) {
+        mouse->intf->needs_remote_wakeup = 1;
+        mouse->is_open = true;
+    }
+    mutex_unlock(&mouse->pm_mutex);
+
+    usb_autopm_put_interface(mouse->intf);
+    return ret;
 }
 
 static void usb_mouse_close(struct input_dev *dev)
 {
     struct usb_mouse *mouse = input_get_drvdata(dev);
+    int ret;
+
+    mutex_lock(&mouse->pm_mutex);
+    usb_mouse_kill_urbs(mouse);
+    mouse->is_open = false;
+    mutex_unlock(&mouse->pm_mutex);
+
+    ret = usb_autopm_get_interface(mouse->intf);
+    mouse->intf->needs_remote_wakeup = 0;
+    if (!ret)
+        usb_autopm_put_interface(mouse->intf);
+}
+
+// Allocates the ring of URBs and their DMA buffers.
+// Each buffer holds the largest report declared by the report descriptor, but at least one full packet of the endpoint. So the mouse can never overflow it.
+static int usb_mouse_alloc_urbs(struct usb_mouse *mouse, int pipe, int maxp, int interval)
+{
+    int i;
+
+    mouse->data_len = min_t(int, max_t(int, mouse->data_pos->report_len, maxp), HID_MAX_BUFFER_SIZE);
+    mouse->num_urbs = clamp_t(int, g_urbs, 1, MAX_URBS);
+    for (i = 0; i < mouse->num_urbs; i++) {
+        mouse->data[i] = usb_alloc_coherent(mouse->usbdev, mouse->data_len, GFP_KERNEL, &mouse->data_dma[i]);
+        mouse->irq[i] = usb_alloc_urb(0, GFP_KERNEL);
+        if (!mouse->data[i] || !mouse->irq[i])
+            return -ENOMEM;
+
+        usb_fill_int_urb(mouse->irq[i], mouse->usbdev, pipe, mouse->data[i],
+                 mouse->data_len,
+                 usb_mouse_irq, mouse, interval);
+        mouse->irq[i]->transfer_dma = mouse->data_dma[i];
+        mouse->irq[i]->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+    }
+
+    return 0;
+}
 
-    usb_kill_urb(mouse->irq);
+static void usb_mouse_free_urbs(struct usb_mouse *mouse)
+{
+    int i;
+
+    for (i = 0; i < MAX_URBS; i++) {
+        usb_free_urb(mouse->irq[i]);
+        if (mouse->data[i])
+            usb_free_coherent(mouse->usbdev, mouse->data_len, mouse->data[i], mouse->data_dma[i]);
+        mouse->irq[i] = NULL;
+        mouse->data[i] = NULL;
+    }
 }
+                                                                //Leetmouse Mod END
 
 static int hid_get_class_descriptor(struct usb_device *dev, int ifnum,
         unsigned char type, void *buf, int size)
@@ -164,7 +323,9 @@ static int usb_mouse_probe(struct usb_interface *intf, const struct usb_device_i
     // ##########################################################################
     struct hid_descriptor *hdesc;
     struct report_positions *rpos;
+    struct desc_cache_key key;
     unsigned int rsize = 0;
+    int rlen;
     int num_descriptors;
     char *rdesc;
     unsigned int n = 0;
@@ -174,6 +335,12 @@ static int usb_mouse_probe(struct usb_interface *intf, const struct usb_device_i
         size_t offset = offsetof(struct hid_descriptor, rpt_desc);
     #endif
 
+
+    //With hid_bind, mice are accelerated on top of usbhid. Binding one here would take it away from there.
+    if (hid_mouse_enabled()) {
+        printk("LEETMOUSE: hid_bind is set. Leave the mouse to usbhid instead of binding it to the USB driver.");
+        return -ENODEV;
+    }
                                                                 //Leetmouse Mod END
     interface = intf->cur_altsetting;
 
@@ -194,10 +361,6 @@ static int usb_mouse_probe(struct usb_interface *intf, const struct usb_device_i
     mouse = kzalloc(sizeof(struct usb_mouse), GFP_KERNEL);
     input_dev = input_allocate_device();
     if (!mouse || !input_dev)
-        goto fail1;
-    
-    mouse->data = usb_alloc_coherent(dev, BUFFER_SIZE, GFP_KERNEL, &mouse->data_dma); //Leetmouse Mod
-    if (!mouse->data)
         goto fail1;
 
                                                                 //Leetmouse Mod BEGIN
@@ -233,40 +396,51 @@ static int usb_mouse_probe(struct usb_interface *intf, const struct usb_device_i
         goto fail1;
     }
 
-    rdesc = kmalloc(rsize, GFP_KERNEL);
-    if (!rdesc)
+    rpos = kmalloc(sizeof(struct report_positions), GFP_KERNEL);
+    if (!rpos)
         goto fail1;
+    mouse->data_pos = rpos;
 
-    //hid_set_idle(dev, interface->desc.bInterfaceNumber, 0, 0);
+    //Re-plugs and rebinds of a known mouse take its layout from the cache, without reading the descriptor again.
+    //Otherwise read and parse the descriptor. Only descriptors, which have been read entirely, are cached.
+    desc_cache_key_init(&key, dev, interface->desc.bInterfaceNumber, rsize);
+    if (desc_cache_get(&key, rpos)) {
+        ret = 0;
+    } else {
+        rdesc = kmalloc(rsize, GFP_KERNEL);
+        if (!rdesc) {
+            ret = -ENOMEM;
+            goto fail1_5;
+        }
 
-    ret = hid_get_class_descriptor(dev, interface->desc.bInterfaceNumber,
-            HID_DT_REPORT, rdesc, rsize);
-    if (ret < 0) {
-        dbg_hid("reading report descriptor failed\n");
-        kfree(rdesc);
-        goto fail1;
-    }
+        //hid_set_idle(dev, interface->desc.bInterfaceNumber, 0, 0);
 
-    rpos = kmalloc(sizeof(struct report_positions), GFP_KERNEL);
-    if (!rpos){
+        ret = hid_get_class_descriptor(dev, interface->desc.bInterfaceNumber,
+                HID_DT_REPORT, rdesc, rsize);
+        if (ret < 0) {
+            dbg_hid("reading report descriptor failed\n");
+            kfree(rdesc);
+            goto fail1_5;
+        }
+        rlen = ret;
+
+        ret = parse_report_desc(rdesc, rsize, rpos);
+        if (ret >= 0 && rlen == rsize)
+            desc_cache_put(&key, rdesc, rpos);
         kfree(rdesc);
-        goto fail1;
     }
-    mouse->data_pos = rpos;
-
-    //Parse the descriptor and delete it
-    ret = parse_report_desc(rdesc, rsize, rpos);
-    kfree(rdesc);
     if (ret < 0)
         goto fail1_5;
                                                                 //Leetmouse Mod END
 
-    mouse->irq = usb_alloc_urb(0, GFP_KERNEL);
-    if (!mouse->irq)
-        goto fail2;
-
     mouse->usbdev = dev;
     mouse->dev = input_dev;
+    mouse->intf = intf;                                         //Leetmouse Mod
+    mutex_init(&mouse->pm_mutex);                               //Leetmouse Mod
+
+    ret = usb_mouse_alloc_urbs(mouse, pipe, maxp, endpoint->bInterval); //Leetmouse Mod
+    if (ret)                                                    //Leetmouse Mod
+        goto fail2;
 
     if (dev->manufacturer)
         strscpy(mouse->name, dev->manufacturer, sizeof(mouse->name));
@@ -304,23 +478,36 @@ static int usb_mouse_probe(struct usb_interface *intf, const struct usb_device_i
     input_dev->open = usb_mouse_open;
     input_dev->close = usb_mouse_close;
 
-    usb_fill_int_urb(mouse->irq, dev, pipe, mouse->data,
-             (maxp > BUFFER_SIZE ? BUFFER_SIZE : maxp),         //Leetmouse Mod
-             usb_mouse_irq, mouse, endpoint->bInterval);
-    mouse->irq->transfer_dma = mouse->data_dma;
-    mouse->irq->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+                                                                //Leetmouse Mod BEGIN
+    // Polling interval of the endpoint. High-speed (and faster) devices count in 125 µs microframes, full- and low-speed devices in 1 ms frames.
+    accel_init(&mouse->accel, mouse->irq[0]->interval * (dev->speed >= USB_SPEED_HIGH ? 125 : 1000));
+
+    ret = stats_init(&mouse->stats);
+    if (ret)
+        goto fail3;
+                                                                //Leetmouse Mod END
 
     ret = input_register_device(mouse->dev);                    //Leetmouse Mod
     if (ret)                                                    //Leetmouse Mod
         goto fail3;
 
     usb_set_intfdata(intf, mouse);
+
+                                                                //Leetmouse Mod BEGIN
+    // Statistics are optional. The mouse works without them.
+    if (stats_sysfs_add(&mouse->stats, &intf->dev))
+        dev_warn(&intf->dev, "failed to create the leetmouse sysfs group\n");
+    capture_add(&mouse->capture, dev_name(&intf->dev));
+    if (motion_add(&mouse->motion, &intf->dev))
+        dev_warn(&intf->dev, "failed to create the leetmouse motion stream\n");
+                                                                //Leetmouse Mod END
     return 0;
 
 fail3:    
-    usb_free_urb(mouse->irq);
+    stats_release(&mouse->stats);                               //Leetmouse Mod
+    accel_release(&mouse->accel);                               //Leetmouse Mod
 fail2:    
-    usb_free_coherent(dev, BUFFER_SIZE, mouse->data, mouse->data_dma); //Leetmouse Mod
+    usb_mouse_free_urbs(mouse);                                 //Leetmouse Mod
 fail1_5:
     kfree(mouse->data_pos);
 fail1:    
@@ -335,17 +522,76 @@ static void usb_mouse_disconnect(struct usb_interface *intf)
 
     usb_set_intfdata(intf, NULL);
     if (mouse) {
-        usb_kill_urb(mouse->irq);
-        input_unregister_device(mouse->dev);
-        usb_free_urb(mouse->irq);
                                                                 //Leetmouse Mod BEGIN
-        usb_free_coherent(interface_to_usbdev(intf), BUFFER_SIZE, mouse->data, mouse->data_dma);
+        stats_sysfs_remove(&mouse->stats, &intf->dev);
+        usb_mouse_kill_urbs(mouse);
+        capture_remove(&mouse->capture);
+        motion_remove(&mouse->motion);
+        input_unregister_device(mouse->dev);
+        usb_mouse_free_urbs(mouse);
+        stats_release(&mouse->stats);
+        accel_release(&mouse->accel);
         kfree(mouse->data_pos);
                                                                 //Leetmouse Mod END
         kfree(mouse);
     }
 }
 
+                                                                //Leetmouse Mod BEGIN
+// Suspend and resume keep the parsed layout and the acceleration state. Only the URBs are killed and resubmitted, so the mouse is not probed again.
+static int usb_mouse_suspend(struct usb_interface *intf, pm_message_t message)
+{
+    struct usb_mouse *mouse = usb_get_intfdata(intf);
+
+    mutex_lock(&mouse->pm_mutex);
+    usb_mouse_kill_urbs(mouse);
+    mutex_unlock(&mouse->pm_mutex);
+
+    return 0;
+}
+
+static int usb_mouse_resume(struct usb_interface *intf)
+{
+    struct usb_mouse *mouse = usb_get_intfdata(intf);
+    int ret = 0;
+
+    mutex_lock(&mouse->pm_mutex);
+    if (mouse->is_open)
+        ret = usb_mouse_submit_urbs(mouse, GFP_NOIO);
+    mutex_unlock(&mouse->pm_mutex);
+
+    return ret;
+}
+
+// A boot-protocol mouse keeps no state, which would be lost by a reset. So resuming after a reset is just a regular resume.
+static int usb_mouse_reset_resume(struct usb_interface *intf)
+{
+    return usb_mouse_resume(intf);
+}
+
+// Without these, the USB core would unbind and probe the driver again on every reset of the device
+static int usb_mouse_pre_reset(struct usb_interface *intf)
+{
+    struct usb_mouse *mouse = usb_get_intfdata(intf);
+
+    mutex_lock(&mouse->pm_mutex);
+    usb_mouse_kill_urbs(mouse);
+    return 0;
+}
+
+static int usb_mouse_post_reset(struct usb_interface *intf)
+{
+    struct usb_mouse *mouse = usb_get_intfdata(intf);
+    int ret = 0;
+
+    if (mouse->is_open)
+        ret = usb_mouse_submit_urbs(mouse, GFP_NOIO);
+    mutex_unlock(&mouse->pm_mutex);
+
+    return ret;
+}
+                                                                //Leetmouse Mod END
+
 static const struct usb_device_id usb_mouse_id_table[] = {
     { USB_INTERFACE_INFO(USB_INTERFACE_CLASS_HID, USB_INTERFACE_SUBCLASS_BOOT,
         USB_INTERFACE_PROTOCOL_MOUSE) },
@@ -359,6 +605,54 @@ static struct usb_driver usb_mouse_driver = {
     .probe        = usb_mouse_probe,
     .disconnect    = usb_mouse_disconnect,
     .id_table    = usb_mouse_id_table,
+    .suspend    = usb_mouse_suspend,                            //Leetmouse Mod
+    .resume        = usb_mouse_resume,                          //Leetmouse Mod
+    .reset_resume    = usb_mouse_reset_resume,                  //Leetmouse Mod
+    .pre_reset    = usb_mouse_pre_reset,                        //Leetmouse Mod
+    .post_reset    = usb_mouse_post_reset,                      //Leetmouse Mod
+    .supports_autosuspend = 1,                                  //Leetmouse Mod
 };
 
-module_usb_driver(usb_mouse_driver);
+                                                                //Leetmouse Mod BEGIN
+static int __init usb_mouse_init(void)
+{
+    int ret;
+
+    accel_setup();
+    capture_init();
+    ret = curve_init();
+    if (ret)
+        goto fail;
+
+    ret = usb_register(&usb_mouse_driver);
+    if (ret)
+        goto fail_curve;
+
+    ret = hid_mouse_register();
+    if (ret) {
+        usb_deregister(&usb_mouse_driver);
+        goto fail_curve;
+    }
+    return 0;
+
+fail_curve:
+    curve_exit();
+fail:
+    capture_exit();
+    return ret;
+}
+
+static void __exit usb_mouse_exit(void)
+{
+    hid_mouse_unregister();
+    usb_deregister(&usb_mouse_driver);
+    curve_exit();
+    // All devices are gone now. Free the last published parameter snapshot and the descriptor cache.
+    accel_cleanup();
+    desc_cache_clear();
+    capture_exit();
+}
+
+module_init(usb_mouse_init);
+module_exit(usb_mouse_exit);
+                                                                //Leetmouse Mod END
@@ -2,7 +2,14 @@
 
 #include "util.h"
 #include <linux/kernel.h>   //fixed-len datatypes
-#include <linux/string.h>   //memcpy
+#include <linux/string.h>   //memset
+#include <linux/errno.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,12,0)
+    #include <asm/unaligned.h>
+#else
+    #include <linux/unaligned.h>
+#endif
 
 // ########## Kernel module parameters
 // Debug parameters
@@ -12,28 +19,78 @@ module_param_named(debug, g_debug, byte, 0644);
 
 //This is the most crudest HID descriptor parser EVER.
 //We will skip most control words until we found an interesting one
-//We also assume, that the first button-definition we will find is the most important one,
-//so we will ignore any further button definitions
+//We also assume, that the first button-definition we will find in a report is the most important one,
+//so we will ignore any further button definitions of that report
 
 struct parser_context {
     unsigned char id;                           // Report ID
     unsigned int offset;                        // Local offset in this report ID context
+    struct report_layout *layout;               // Layout of this report. Created as soon as we find any field of interest
 };
 
 #define NUM_USAGES 32
 #define NUM_CONTEXTS 32                             // This should be more than enough for a HID mouse. If we exceed this number, the parser below will eventually fail
-#define SET_ENTRY(entry, _id, _offset, _size, _sign) \
-    entry.id = _id;                                 \
-    entry.offset = _offset;                         \
-    entry.size = _size;                             \
-    entry.sgn = _sign;
+#define SET_ENTRY(layout, field, _offset, _size, _sign) \
+    layout->field.offset = _offset;                 \
+    layout->field.size = _size;                     \
+    layout->field.sgn = _sign;                      \
+    layout->fields |= field##_bit;
+#define button_bit REPORT_BUTTON
+#define x_bit REPORT_X
+#define y_bit REPORT_Y
+#define wheel_bit REPORT_WHEEL
+
+//Compiles a parsed report_entry into its report_field. Returns 0, if the value cannot be loaded with a single 4-byte access.
+static int compile_entry(struct report_field *f, const struct report_entry *e)
+{
+    unsigned int shift = e->offset % 8;
+
+    if(!e->size || shift + e->size > 32)
+        return 0;
+
+    f->byte = e->offset / 8;
+    f->nbytes = (shift + e->size + 7) / 8;
+    f->lshift = 32 - shift - e->size;
+    f->rshift = 32 - e->size;
+    f->sgn = e->sgn;
+    return 1;
+}
+
+//Compiles all fields of a layout and registers it for its report ID
+#define COMPILE_ENTRY(layout, field)                                            \
+    if((layout->fields & field##_bit) && !compile_entry(&layout->f_##field, &layout->field)) \
+        layout->fields &= ~field##_bit;                                         \
+    if((layout->fields & field##_bit) && layout->f_##field.byte + layout->f_##field.nbytes > layout->len) \
+        layout->len = layout->f_##field.byte + layout->f_##field.nbytes;
+static void compile_layout(struct report_positions *pos, int n)
+{
+    struct report_layout *l = pos->layouts + n;
+
+    COMPILE_ENTRY(l, button);
+    COMPILE_ENTRY(l, x);
+    COMPILE_ENTRY(l, y);
+    COMPILE_ENTRY(l, wheel);
+    if(l->fields)
+        pos->id_map[l->id] = n + 1;
+}
+
+//Returns the layout of the report in context c. Creates it, if this is the first field of interest in this report.
+static struct report_layout *context_layout(struct report_positions *pos, struct parser_context *c)
+{
+    if(!c->layout && pos->num_layouts < NUM_LAYOUTS){
+        c->layout = pos->layouts + pos->num_layouts++;
+        c->layout->id = c->id;
+    }
+    return c->layout;
+}
 
 int parse_report_desc(unsigned char *buffer, int buffer_len, struct report_positions *pos)
 {
     int r_count = 0, r_size = 0, r_sgn = 0, len = 0;
     int r_usage[NUM_USAGES];
-    unsigned char ctl, button = 0;
+    unsigned char ctl;
     unsigned char *data;
+    struct report_layout *l;
 
     unsigned int n, i = 0;
 
@@ -46,12 +103,14 @@ int parse_report_desc(unsigned char *buffer, int buffer_len, struct report_posit
         r_usage[n] = 0;
     }
     
-    pos->report_id_tagged = 0;
+    //Start without any layouts. Reports, which never show up in the descriptor, stay unmapped
+    memset(pos, 0, sizeof(struct report_positions));
 
     //Initialize contexts to zero
     for(n = 0; n < NUM_CONTEXTS; n++){
         contexts[n].id = 0;
         contexts[n].offset = 0;
+        contexts[n].layout = NULL;
     }
 
     while(i < buffer_len){
@@ -108,7 +167,7 @@ int parse_report_desc(unsigned char *buffer, int buffer_len, struct report_posit
                 break;
             //case 4:
             //Sure, we could also now check 4 bytes, as it is written down in the HID specs...
-            //However, my extract_at function does not support 4-byte numbers and I don't see, why I should implement it. A mouse should never need to send 4-bytes long messages IMHO.
+            //However, extract_field() loads at most 4 bytes per value anyway and I don't see, why I should implement it. A mouse should never need to send 4-bytes long messages IMHO.
             }
         }
 
@@ -132,28 +191,29 @@ int parse_report_desc(unsigned char *buffer, int buffer_len, struct report_posit
 
         // ######## Main items
         //Check, if we reached the end of this input data type
-        if(ctl == D_INPUT || ctl == D_FEATURE){
+        if((ctl == D_INPUT || ctl == D_FEATURE) && r_usage[0] && (l = context_layout(pos, c))){
             //Buttons are handled separately
-            if(!button && r_usage[0] == D_USAGE_BUTTON){
-                SET_ENTRY(pos->button, c->id, c->offset, r_size*r_count, r_sgn);
-                button = 1;
+            if(!(l->fields & REPORT_BUTTON) && r_usage[0] == D_USAGE_BUTTON){
+                SET_ENTRY(l, button, c->offset, r_size*r_count, r_sgn);
             } else {
             //X,Y and WHEEL
                 for(n = 0; n < r_count; n++){
                     switch(r_usage[n]){
                     case D_USAGE_X:
-                        SET_ENTRY(pos->x, c->id, c->offset + r_size*n, r_size, r_sgn);
+                        SET_ENTRY(l, x, c->offset + r_size*n, r_size, r_sgn);
                         break;
                     case D_USAGE_Y:
-                        SET_ENTRY(pos->y, c->id, c->offset + r_size*n, r_size, r_sgn);
+                        SET_ENTRY(l, y, c->offset + r_size*n, r_size, r_sgn);
                         break;
                     case D_USAGE_WHEEL:
-                        SET_ENTRY(pos->wheel, c->id, c->offset + r_size*n, r_size, r_sgn);
+                        SET_ENTRY(l, wheel, c->offset + r_size*n, r_size, r_sgn);
                         break;
                     }
 
                 }
             }
+        }
+        if(ctl == D_INPUT || ctl == D_FEATURE){
             //Reset usages
             for(n = 0; n < NUM_USAGES; n++){
                 r_usage[n] = 0;
@@ -163,123 +223,144 @@ int parse_report_desc(unsigned char *buffer, int buffer_len, struct report_posit
         }
         i += len + 1;
     }
-    
-    if(g_debug){
-        printk("BTN\t(%d): Offset %u\tSize %u\t Sign %u",   pos->button.id ,    (unsigned int) pos->button.offset,  pos->button.size,   pos->button.sgn);
-        printk("X\t(%d): Offset %u\tSize %u\t Sign %u",     pos->x.id,          (unsigned int) pos->x.offset,       pos->x.size,        pos->x.sgn);
-        printk("Y\t(%d): Offset %u\tSize %u\t Sign %u",     pos->x.id,          (unsigned int) pos->y.offset,       pos->y.size,        pos->x.sgn);
-        printk("WHL\t(%d): Offset %u\tSize %u\t Sign %u",   pos->wheel.id,      (unsigned int) pos->wheel.offset,   pos->wheel.size,    pos->wheel.sgn);
+
+    //Length of the largest report (in bytes, including the report ID), which sizes the transfer buffers
+    for(n = 0; n < NUM_CONTEXTS; n++){
+        if((contexts[n].offset + 7) / 8 > pos->report_len)
+            pos->report_len = (contexts[n].offset + 7) / 8;
     }
+    if(g_debug)
+        printk("Largest report: %u bytes", pos->report_len);
+
+    //Compile the extraction plans, which are used for every packet from now on
+    compile_report_positions(pos);
 
     return 0;
 }
 
-//Shifts an array *data of length data_len (in bytes) by amounts of num in bits to the right/left, depending on right = 1/0 (maximum bits to shift: 8)
-//This shift method is assuming little-endian data, as it is dictated by the HID standard.
-//So taking a byte as [MSB, ..., LSB], then e.g. a 2 byte long array "[7,8,6,5,4,3,2,1,0], [15,14,13,12,11,10,9] << 2" (left = 1, num = 2) becomes "[5,4,3,2,1,0,_,_], [13,12,11,10,9,8,7,6]"
-//Most certainly not the most elegant and fastest way to do this. However, it works. (Limiting this to only 4-byte long data, one could use a preprocessor define, which is way faster but bound to that type).
-inline void array_shift_le(unsigned char *data, int data_len, bool right, int num){
-    int i;
-    if(num == 0) return;
-
-    //Right shift
-    if(right){
-        for(i = 0; i < data_len; i++){
-            data[i] >>= num;
-            if(i + 1 < data_len){
-                data[i] |= data[i+1] << (8 - num);
-            }
-        }
-    //Left shift
-    } else {
-        for(i = data_len - 1; i >= 0; i--){
-            data[i] <<= num;
-            if(i){
-                data[i] |= data[i-1] >> (8 - num);
-            }
+//Compiles the extraction plans of all layouts and maps their report IDs. Fields, which cannot be extracted with a single 4-byte load, are dropped.
+void compile_report_positions(struct report_positions *pos)
+{
+    struct report_layout *l;
+    unsigned int n;
+
+    for(n = 0; n < pos->num_layouts; n++){
+        compile_layout(pos, n);
+
+        if(g_debug){
+            l = pos->layouts + n;
+            printk("Report ID %d: Fields 0x%x\tLength %u", l->id, l->fields, l->len);
+            printk("BTN\t(%d): Offset %u\tSize %u\t Sign %u",   l->id,  (unsigned int) l->button.offset,    l->button.size, l->button.sgn);
+            printk("X\t(%d): Offset %u\tSize %u\t Sign %u",     l->id,  (unsigned int) l->x.offset,         l->x.size,      l->x.sgn);
+            printk("Y\t(%d): Offset %u\tSize %u\t Sign %u",     l->id,  (unsigned int) l->y.offset,         l->y.size,      l->y.sgn);
+            printk("WHL\t(%d): Offset %u\tSize %u\t Sign %u",   l->id,  (unsigned int) l->wheel.offset,     l->wheel.size,  l->wheel.sgn);
         }
     }
 }
 
-//Extracts a number from a raw USB stream, according to its bit-position and bit-size as stated in the report_entry
-inline int extract_at(unsigned char *data, int data_len, struct report_entry *entry)
+//Loads 1-4 bytes in little-endian order, as dictated by the HID standard
+INLINE u32 load_le(const unsigned char *data, unsigned char nbytes)
 {
-    int size = entry->size/8;           //Size of our data in bytes
-    int i = entry->offset/8;            //Starting index of data[] to access in byte-aligned size
-    char shift = entry->offset % 8;     //Remaining bits to shift left, until we reach our target data
-    union {
-        __u8 raw[4];    //Raw buffer of individual bytes. Must be of same length as "init" and at least 2 bytes bigger than the biggest datatype you want to handle in here
-        __u32 init;     //Continous buffer of aboves bytes (used for initialization)
-        __s8 s8;        //Return value
-        __s16 s16;      //Return value
-        __u8 u8;        //Return value
-        __u16 u16;      //Return value
-    } buffer;
-
-    //Data structure to read is bigger than a clear multiple of 8 bits. Read one more byte.
-    if(entry->size % 8) size += 1;
-    //The bit position is not aligned with byte-size. Read one more byte to make sure, we catch all necessary bits
-    if(shift) size += 1;
-    //Data structure to read is bigger than we can handle. Abort
-    if(size > sizeof(buffer.init)) return 0;
-
-    buffer.init = 0; //Initialized buffer to zero
-
-    //Avoid access violation when using memcpy.
-    if(i + size > data_len) return 0;
-
-    //Create a local copy, that we can modify.
-    memcpy(buffer.raw, data + i, size);
-
-    //NOTE: All data manipulation below is only valid for little-endian data. The HID standard however dictates little-endian, so this is fine. However, we need to transform to machine data in the end for multi-byte types
-    if(shift)
-        array_shift_le(buffer.raw,size,true,shift);         //Align bits to memory
-
-    if(entry->size <= 8){
-        buffer.raw[0] &= 0xFF >> (8 - entry->size);         //Zero MSB bits, if entry->size < 8
-        if(entry->sgn)                                      //If the initial value was signed and if it was not exactly of size 8, we need to add the missing sign-bits, which have been masked above with zeros.
-            buffer.raw[0] = buffer.raw[0] >> (8 - entry->size - 1) == 0 ? buffer.raw[0] : (0xFF ^ (0xFF >> (8 - entry->size))) | buffer.raw[0];
-        
-        return (int) (entry->sgn ? buffer.s8 : buffer.u8);
+    switch(nbytes){
+    case 1:
+        return data[0];
+    case 2:
+        return get_unaligned_le16(data);
+    case 3:
+        return get_unaligned_le16(data) | ((u32) data[2] << 16);
+    default:
+        return get_unaligned_le32(data);
     }
-    if(entry->size <= 16){
-        buffer.raw[1] &= 0xFF >> (16 - entry->size);        //Zero MSB bits, if entry->size < 16
-        if(entry->sgn)                                      //If the initial value was signed and if it was not exactly of size 16, we need to add the missing sign-bits, which have been masked above with zeros.
-            buffer.raw[1] = buffer.raw[1] >> (16 - entry->size - 1) == 0 ? buffer.raw[1] : (0xFF ^ (0xFF >> (16 - entry->size))) | buffer.raw[1];
+}
 
-        buffer.u16 = le16_to_cpu(buffer.u16);               //Convert to machine units
-        return (int) (entry->sgn ? buffer.s16 : buffer.u16);
+//Stores 1-4 bytes in little-endian order. Counterpart of load_le().
+INLINE void store_le(unsigned char *data, unsigned char nbytes, u32 value)
+{
+    switch(nbytes){
+    case 1:
+        data[0] = value;
+        break;
+    case 2:
+        put_unaligned_le16(value, data);
+        break;
+    case 3:
+        put_unaligned_le16(value, data);
+        data[2] = value >> 16;
+        break;
+    default:
+        put_unaligned_le32(value, data);
+        break;
     }
+}
 
-    return 0; //All other lengths are not supported.
+//Extracts a number from a raw USB packet, according to its compiled report_field.
+//Shifting the value up to bit 31 and back down again drops the neighbouring bits and sign-extends it in one go.
+INLINE int extract_field(const unsigned char *data, const struct report_field *f)
+{
+    u32 raw = load_le(data + f->byte, f->nbytes) << f->lshift;
+
+    if(f->sgn)
+        return (int) ((s32) raw >> f->rshift);
+    return (int) (raw >> f->rshift);
 }
 
 // Extracts the interesting mouse data from the raw USB data, according to the layout delcared in the report descriptor
+// Returns the fields found in this packet (REPORT_* bitmask) or a negative value, if the packet does not carry any mouse data
 int extract_mouse_events(unsigned char *buffer, int buffer_len, struct report_positions *pos, int *btn, int *x, int *y, int *wheel)
 {
-    unsigned char id = 0;
-
-    if(g_debug){
-        int i;
-        printk(KERN_CONT "Raw: ");
-        for(i = 0; i<buffer_len;i++){
-            printk(KERN_CONT "0x%02x ", (int) buffer[i]);
-        }
-        printk(KERN_CONT "\n");
-    }
+    const struct report_layout *l;
+    unsigned char id = 0, n;
 
+    *btn = 0; *x = 0; *y = 0; *wheel = 0;
+    if(buffer_len < 1)
+        return -EINVAL;
     if(pos->report_id_tagged)
         id = buffer[0];
 
-    *btn = 0; *x = 0; *y = 0; *wheel = 0;
-    if(pos->button.id == id)
-        *btn =      extract_at(buffer, buffer_len, &pos->button);
-    if(pos->x.id == id)
-        *x =        extract_at(buffer, buffer_len, &pos->x);
-    if(pos->y.id == id)
-        *y =        extract_at(buffer, buffer_len, &pos->y);
-    if(pos->wheel.id == id)
-        *wheel =    extract_at(buffer, buffer_len, &pos->wheel);
+    //Reports we do not know (or which carry no mouse data) are dropped right away
+    n = pos->id_map[id];
+    if(!n)
+        return -ENOENT;
+    l = pos->layouts + n - 1;
+    if(buffer_len < l->len)
+        return -EINVAL;
+
+    if(l->fields & REPORT_BUTTON)
+        *btn =      extract_field(buffer, &l->f_button);
+    if(l->fields & REPORT_X)
+        *x =        extract_field(buffer, &l->f_x);
+    if(l->fields & REPORT_Y)
+        *y =        extract_field(buffer, &l->f_y);
+    if(l->fields & REPORT_WHEEL)
+        *wheel =    extract_field(buffer, &l->f_wheel);
+
+    return l->fields;
+}
 
-    return 0;
+//Writes a number back into a raw packet, according to its compiled report_field. The neighbouring bits stay untouched.
+//Values beyond the range of the field are clamped to it. Returns the value written.
+INLINE int insert_field(unsigned char *data, const struct report_field *f, int value)
+{
+    unsigned int size = 32 - f->rshift, shift = f->rshift - f->lshift;
+    s64 max = f->sgn ? (1ll << (size - 1)) - 1 : (1ll << size) - 1;
+    s64 min = f->sgn ? -(1ll << (size - 1)) : 0;
+    u32 mask = (u32) (((1ull << size) - 1) << shift);
+    u32 raw = load_le(data + f->byte, f->nbytes);
+
+    value = clamp_t(s64, value, min, max);
+    raw = (raw & ~mask) | (((u32) value << shift) & mask);
+    store_le(data + f->byte, f->nbytes, raw);
+    return value;
+}
+
+// Writes the (accelerated) motion back into a packet, which extract_mouse_events() accepted before. Only the given fields are written.
+// x, y and wheel are updated to what the packet carries now: Clamped to the range of their field, 0 if it was not written.
+void insert_mouse_events(unsigned char *buffer, struct report_positions *pos, int fields, int *x, int *y, int *wheel)
+{
+    const struct report_layout *l = pos->layouts + pos->id_map[pos->report_id_tagged ? buffer[0] : 0] - 1;
+
+    fields &= l->fields;
+    *x = fields & REPORT_X ? insert_field(buffer, &l->f_x, *x) : 0;
+    *y = fields & REPORT_Y ? insert_field(buffer, &l->f_y, *y) : 0;
+    *wheel = fields & REPORT_WHEEL ? insert_field(buffer, &l->f_wheel, *wheel) : 0;
 }
@@ -10,6 +10,8 @@ enum D_hid_descriptor{
 
     D_REPORT_ID = 0x84,
     D_INPUT = 0x80,
+    D_OUTPUT = 0x90,
+    D_COLLECTION = 0xA0,
     D_FEATURE = 0xB0,
     D_REPORT_SIZE = 0x74,
     D_REPORT_COUNT = 0x94,
@@ -27,24 +29,61 @@ enum hid_data{
     D_USAGE_Y = 0x31
 };
 
-//Stores the bit offset, bit size, sign and associated report ID of an entry for extracting the value from the raw usb_mouse->data buffer
+//Stores the bit offset, bit size and sign of an entry for extracting the value from the raw usb_mouse->data buffer
 struct report_entry {
-    unsigned char id;       // Report ID
 	unsigned char offset;	// In bits
 	unsigned char size;		// In bits
     unsigned char sgn;      // Is this value signed (1) or unsigned (0)?
 };
 
-//Stores a collection of important offsets & sizes etc for the received raw data in the usb_mouse->data buffer
-struct report_positions {
-    int report_id_tagged;   //When the report descriptor parser recognizes a report ID is used, this field is set to 1
+//Compiled form of a report_entry: Everything needed to pull the value out of a packet with a single little-endian load and two shifts.
+//The value is loaded from data[byte] (nbytes bytes wide), shifted left by lshift, so its MSB becomes bit 31, and shifted right by rshift (arithmetic for signed values).
+struct report_field {
+    unsigned char byte;     // First byte of the value within the packet
+    unsigned char nbytes;   // Bytes to load (1-4)
+    unsigned char lshift;   // 32 - (bit offset within the first byte) - size
+    unsigned char rshift;   // 32 - size
+    unsigned char sgn;      // Is this value signed (1) or unsigned (0)?
+};
+
+//Fields of interest within a report. Returned by extract_mouse_events() as a bitmask.
+enum report_fields {
+    REPORT_BUTTON = 0x01,
+    REPORT_X = 0x02,
+    REPORT_Y = 0x04,
+    REPORT_WHEEL = 0x08,
+};
+
+//Layout of one report (identified by its report ID), which carries at least one of the fields of interest
+struct report_layout {
+    unsigned char id;       // Report ID
+    unsigned char fields;   // Fields present in this report (REPORT_* bitmask)
+    unsigned char len;      // Minimum packet length (in bytes) to extract all fields
 	struct report_entry button;
 	struct report_entry x;
 	struct report_entry y;
 	struct report_entry wheel;
+    //Extraction plan. Built once by parse_report_desc(), used for every packet.
+    struct report_field f_button;
+    struct report_field f_x;
+    struct report_field f_y;
+    struct report_field f_wheel;
+};
+
+#define NUM_LAYOUTS 8       // Reports with mouse data we keep track of. Any further will be ignored.
+
+//Stores the layouts of all reports with mouse data for the received raw data in the usb_mouse->data buffer
+struct report_positions {
+    int report_id_tagged;   //When the report descriptor parser recognizes a report ID is used, this field is set to 1
+    unsigned char id_map[256];  //Maps a report ID to its layout (index + 1). 0 for reports without mouse data, which are dropped right away
+    unsigned char num_layouts;
+    unsigned int report_len;    //Length of the largest report in bytes (including the report ID)
+    struct report_layout layouts[NUM_LAYOUTS];
 };
 
 int parse_report_desc(unsigned char *data, int data_len, struct report_positions *data_pos);
+void compile_report_positions(struct report_positions *data_pos);
 int extract_mouse_events(unsigned char *data, int data_len, struct report_positions *data_pos, int *btn, int *x, int *y, int *wheel);
+void insert_mouse_events(unsigned char *data, struct report_positions *data_pos, int fields, int *x, int *y, int *wheel);
 
 #endif  //_UTIL_H